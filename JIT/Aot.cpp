@@ -0,0 +1,225 @@
+// Ahead-of-time compiler for expressions: compiles every line of a file to
+// an exported int name(int x) in a relocatable object, through the same
+// codegen and passes as the JIT, and writes a header of prototypes. The
+// object can be linked in or turned into a shared library and dlopen'ed
+// without initializing LLVM.
+//   ./aot [-o exprs.o] [-header exprs.h] [-prefix expr_] exprs.expr
+// Lines are "[name:] expression"; blank lines and lines starting with #
+// are skipped, unnamed expressions are called <prefix><line number>.
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+#include "Compiler.h"
+#include "Expr.h"
+#include "Parser.h"
+
+namespace {
+  struct Entry {
+    std::string name;
+    std::string source;
+  };
+}
+
+static std::string trim(const std::string &s) {
+  size_t begin = s.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+
+static bool isIdentifier(const std::string &s) {
+  if (s.empty() || isdigit(s[0])) {
+    return false;
+  }
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (!isalnum(s[i]) && s[i] != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool readEntries(const char *path, const std::string &prefix, std::vector<Entry> &entries) {
+  std::ifstream in(path);
+  if (!in) {
+    llvm::errs() << "Cannot read " << path << ".\n";
+    return false;
+  }
+  std::string line;
+  for (unsigned lineNo = 1; std::getline(in, line); ++lineNo) {
+    line = trim(line);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    Entry entry;
+    size_t colon = line.find(':');
+    if (colon != std::string::npos) {
+      entry.name = trim(line.substr(0, colon));
+      entry.source = trim(line.substr(colon + 1));
+    } else {
+      entry.name = prefix + llvm::utostr(lineNo);
+      entry.source = line;
+    }
+    if (!isIdentifier(entry.name)) {
+      llvm::errs() << path << ":" << lineNo << ": '" << entry.name
+                   << "' is not a C identifier.\n";
+      return false;
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].name == entry.name) {
+        llvm::errs() << path << ":" << lineNo << ": " << entry.name
+                     << " is defined twice.\n";
+        return false;
+      }
+    }
+    entries.push_back(entry);
+  }
+  return true;
+}
+
+static std::string guardFor(const std::string &path) {
+  std::string guard;
+  for (size_t i = path.rfind('/') == std::string::npos ? 0 : path.rfind('/') + 1;
+       i < path.size(); ++i) {
+    guard += isalnum(path[i]) ? (char)toupper(path[i]) : '_';
+  }
+  return guard;
+}
+
+static bool writeHeader(const std::string &path, const char *inputPath,
+                        const std::vector<Entry> &entries) {
+  std::string errorInfo;
+  llvm::raw_fd_ostream out(path.c_str(), errorInfo);
+  if (!errorInfo.empty()) {
+    llvm::errs() << errorInfo << "\n";
+    return false;
+  }
+  std::string guard = guardFor(path);
+  out << "/* Generated by aot from " << inputPath << ", do not edit. */\n"
+      << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+      << "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+  for (size_t i = 0; i < entries.size(); ++i) {
+    out << "/* " << entries[i].source << " */\n"
+        << "int " << entries[i].name << "(int x);\n";
+  }
+  out << "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n";
+  return true;
+}
+
+static void usage() {
+  llvm::errs() << "usage: aot [-o <object>] [-header <header>] [-prefix <name prefix>] <expressions>\n";
+}
+
+int main(int argc, char** argv) {
+  std::string objectPath, headerPath, prefix = "expr_";
+  const char *inputPath = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      objectPath = argv[++i];
+    } else if (!strcmp(argv[i], "-header") && i + 1 < argc) {
+      headerPath = argv[++i];
+    } else if (!strcmp(argv[i], "-prefix") && i + 1 < argc) {
+      prefix = argv[++i];
+    } else if (argv[i][0] != '-' && !inputPath) {
+      inputPath = argv[i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (!inputPath) {
+    usage();
+    return 1;
+  }
+  std::string base = inputPath;
+  if (base.size() > 5 && base.compare(base.size() - 5, 5, ".expr") == 0) {
+    base.erase(base.size() - 5);
+  }
+  if (objectPath.empty()) {
+    objectPath = base + ".o";
+  }
+  if (headerPath.empty()) {
+    headerPath = base + ".h";
+  }
+
+  std::vector<Entry> entries;
+  if (!readEntries(inputPath, prefix, entries)) {
+    return 1;
+  }
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  std::string triple = llvm::sys::getDefaultTargetTriple();
+  std::string errStr;
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, errStr);
+  if (!target) {
+    llvm::errs() << errStr << "\n";
+    return 1;
+  }
+  // PIC, so the object can go into a shared library as well.
+  llvm::TargetMachine *machine =
+    target->createTargetMachine(triple, llvm::sys::getHostCPUName(), "",
+                                llvm::TargetOptions(), llvm::Reloc::PIC_,
+                                llvm::CodeModel::Default, llvm::CodeGenOpt::Default);
+
+  llvm::LLVMContext context;
+  llvm::Module *module = new llvm::Module(inputPath, context);
+  module->setTargetTriple(triple);
+  module->setDataLayout(machine->getDataLayout()->getStringRepresentation());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    Expr *expr = parseWholeExpr(entries[i].source);
+    if (!expr) {
+      llvm::errs() << "Invalid expression for " << entries[i].name << ": "
+                   << entries[i].source << "\n";
+      return 1;
+    }
+    llvm::Function *function = genFunction(module, context, expr, entries[i].name.c_str());
+    deleteExpr(expr);
+    optimizeFunction(machine->getDataLayout(), module, function);
+  }
+
+  std::string errorInfo;
+  llvm::tool_output_file object(objectPath.c_str(), errorInfo, llvm::sys::fs::F_Binary);
+  if (!errorInfo.empty()) {
+    llvm::errs() << errorInfo << "\n";
+    return 1;
+  }
+  llvm::PassManager passManager;
+  passManager.add(new llvm::DataLayout(*machine->getDataLayout()));
+  {
+    llvm::formatted_raw_ostream out(object.os());
+    if (machine->addPassesToEmitFile(passManager, out, llvm::TargetMachine::CGFT_ObjectFile)) {
+      llvm::errs() << "The target cannot emit object files.\n";
+      return 1;
+    }
+    passManager.run(*module);
+  }
+  if (!writeHeader(headerPath, inputPath, entries)) {
+    return 1;
+  }
+  object.keep();
+  llvm::outs() << "Compiled " << entries.size() << " expressions to "
+               << objectPath << " and " << headerPath << "\n";
+  delete module;
+  delete machine;
+  return 0;
+}
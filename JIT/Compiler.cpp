@@ -0,0 +1,133 @@
+#include "llvm/Analysis/Verifier.h"
+#include "llvm/Analysis/Passes.h" // this
+#include "llvm/PassManager.h" // this
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JIT.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/IR/DataLayout.h" // this
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar.h" // this
+
+#include "Compiler.h"
+#include "Expr.h"
+#include "PooledMemoryManager.h"
+
+llvm::Function *genFunction(
+    llvm::Module *module,
+    llvm::LLVMContext &context,
+    const Expr *expr,
+    const char *name) {
+  llvm::Function *function =
+     llvm::cast<llvm::Function>(
+         module->getOrInsertFunction(name,
+           llvm::Type::getInt32Ty(context),
+           llvm::Type::getInt32Ty(context),
+           (llvm::Type *)0)
+         );
+  llvm::BasicBlock *bb = llvm::BasicBlock::Create(context, "entry", function);
+  llvm::IRBuilder<> builder(context);
+  builder.SetInsertPoint(bb);
+  llvm::Argument *argX = function->arg_begin();
+  argX->setName("x");
+  VarExpr::varValue = argX;
+  llvm::Value* retVal = expr->gen(&builder, context);
+  builder.CreateRet(retVal);
+  return function;
+}
+
+llvm::Function *genBatchFunction(
+    llvm::Module *module,
+    llvm::LLVMContext &context,
+    const Expr *expr,
+    const char *name) {
+  llvm::Type *intTy = llvm::Type::getInt32Ty(context);
+  llvm::Type *intPtrTy = llvm::Type::getInt32PtrTy(context);
+  llvm::Function *function =
+     llvm::cast<llvm::Function>(
+         module->getOrInsertFunction(name,
+           llvm::Type::getVoidTy(context),
+           intPtrTy, intPtrTy, intTy,
+           (llvm::Type *)0)
+         );
+  llvm::Function::arg_iterator args = function->arg_begin();
+  llvm::Argument *in = args++;
+  in->setName("in");
+  llvm::Argument *out = args++;
+  out->setName("out");
+  llvm::Argument *n = args++;
+  n->setName("n");
+
+  llvm::BasicBlock *entry = llvm::BasicBlock::Create(context, "entry", function);
+  llvm::BasicBlock *loop = llvm::BasicBlock::Create(context, "loop", function);
+  llvm::BasicBlock *exit = llvm::BasicBlock::Create(context, "exit", function);
+  llvm::IRBuilder<> builder(context);
+
+  builder.SetInsertPoint(entry);
+  llvm::Value *zero = llvm::ConstantInt::get(intTy, 0);
+  builder.CreateCondBr(builder.CreateICmpSLE(n, zero, "empty"), exit, loop);
+
+  builder.SetInsertPoint(loop);
+  llvm::PHINode *i = builder.CreatePHI(intTy, 2, "i");
+  i->addIncoming(zero, entry);
+  VarExpr::varValue = builder.CreateLoad(builder.CreateGEP(in, i), "x");
+  llvm::Value *result = expr->gen(&builder, context);
+  builder.CreateStore(result, builder.CreateGEP(out, i));
+  llvm::Value *next = builder.CreateAdd(i, llvm::ConstantInt::get(intTy, 1), "next");
+  i->addIncoming(next, builder.GetInsertBlock());
+  builder.CreateCondBr(builder.CreateICmpEQ(next, n, "done"), exit, loop);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+  return function;
+}
+
+llvm::ExecutionEngine* createEngine(llvm::Module *module, SlabPool *pool) {
+  llvm::InitializeNativeTarget();
+
+  std::string errStr;
+  llvm::EngineBuilder builder(module);
+  builder.setErrorStr(&errStr).setEngineKind(llvm::EngineKind::JIT);
+  if (pool) {
+    llvm::InitializeNativeTargetAsmPrinter();
+    builder.setUseMCJIT(true).setMCJITMemoryManager(new PooledMemoryManager(*pool));
+  }
+  llvm::ExecutionEngine *engine = builder.create();
+
+  if (!engine) {
+    llvm::errs() << "Failed to construct ExecutionEngine: " << errStr << "\n";
+  } else if (llvm::verifyModule(*module)) {
+    llvm::errs() << "Error constructing function!\n";
+  }
+  return engine;
+}
+
+void *getFunctionPointer(llvm::ExecutionEngine *engine, llvm::Function *function) {
+  engine->finalizeObject();
+  return engine->getPointerToFunction(function);
+}
+
+void optimizeFunction(
+  llvm::ExecutionEngine* engine,
+  llvm::Module *module,
+  llvm::Function* function
+) {
+  optimizeFunction(engine->getDataLayout(), module, function);
+}
+
+void optimizeFunction(
+  const llvm::DataLayout *layout,
+  llvm::Module *module,
+  llvm::Function* function
+) {
+  llvm::FunctionPassManager passManager(module);
+  passManager.add(new llvm::DataLayout(*layout));
+  passManager.add(llvm::createInstructionCombiningPass());
+  passManager.add(llvm::createReassociatePass());
+  passManager.add(llvm::createGVNPass());
+  passManager.add(llvm::createCFGSimplificationPass());
+  passManager.doInitialization();
+  passManager.run(*function);
+}
@@ -0,0 +1,49 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "llvm/IR/LLVMContext.h"
+
+namespace llvm {
+  class DataLayout;
+  class ExecutionEngine;
+  class Function;
+  class Module;
+}
+
+class Expr;
+class SlabPool;
+
+// int fun(int x), evaluating expr.
+llvm::Function *genFunction(
+    llvm::Module *module,
+    llvm::LLVMContext &context,
+    const Expr *expr,
+    const char *name = "fun");
+
+// void fun_batch(const int *in, int *out, int n), evaluating expr on
+// every element of in; in and out may alias.
+llvm::Function *genBatchFunction(
+    llvm::Module *module,
+    llvm::LLVMContext &context,
+    const Expr *expr,
+    const char *name = "fun_batch");
+
+// Lazily compiling JIT engine, or an MCJIT engine packing its code into
+// pool when one is given.
+llvm::ExecutionEngine* createEngine(llvm::Module *module, SlabPool *pool = NULL);
+
+// Native entry point of a compiled function; finalizes MCJIT modules.
+void *getFunctionPointer(llvm::ExecutionEngine *engine, llvm::Function *function);
+
+void optimizeFunction(
+  llvm::ExecutionEngine* engine,
+  llvm::Module *module,
+  llvm::Function* function);
+
+// Same passes for code compiled ahead of time for a target with layout.
+void optimizeFunction(
+  const llvm::DataLayout *layout,
+  llvm::Module *module,
+  llvm::Function* function);
+
+#endif
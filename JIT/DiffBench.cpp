@@ -0,0 +1,405 @@
+// Differential check and speed baseline for the compile path: random
+// expressions are evaluated by Expr::eval, by the JIT'd code straight out
+// of Expr::gen, and by the JIT'd code after optimizeFunction (scalar and
+// batch), over the same x values. Any disagreement is a miscompile and is
+// printed as a prefix expression that the driver accepts on stdin.
+//   ./diff-bench [-exprs N] [-ops N] [-depth D] [-xs N] [-seed S] [-v]
+//                [-baseline file [-update]] [-tolerance PCT] ["<expr>"]
+// Expressions have up to -ops operators and -depth levels. Compile time
+// and per-call latency of each variant are reported; with -baseline they
+// are compared with a stored run of the same seed, expressions and x
+// values, and the exit status is 1 on a mismatch or when a figure got more
+// than PCT percent (default 25) worse. A baseline recorded with other
+// parameters is refused.
+#include <stdint.h>
+#include <time.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Compiler.h"
+#include "Expr.h"
+#include "Parser.h"
+
+typedef int (*ScalarFn)(int);
+typedef void (*BatchFn)(const int *in, int *out, int n);
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// splitmix64, so a seed gives the same expressions on every platform.
+class Random {
+  public:
+    explicit Random(uint64_t seed) : state(seed) {}
+    uint64_t next() {
+      uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+    unsigned below(unsigned n) { return n ? next() % n : 0; }
+  private:
+    uint64_t state;
+};
+
+// Literals are non-negative in the source language; negative and
+// overflowing values come from the arithmetic.
+static unsigned randomLiteral(Random &rng) {
+  static const unsigned edges[] = { 0, 1, 2, 3, 7, 255, 65535, 65536, INT_MAX };
+  switch (rng.below(3)) {
+    case 0: return edges[rng.below(sizeof(edges) / sizeof(edges[0]))];
+    case 1: return rng.below(1000);
+    default: return rng.below(INT_MAX);
+  }
+}
+
+// Prefix source of a random tree with ops operators and at most depth
+// levels below it; the depth limit may leave some operators out.
+static void randomSource(Random &rng, unsigned ops, unsigned depth, std::string &src) {
+  if (ops == 0 || depth == 0) {
+    if (rng.below(2)) {
+      src += "x";
+    } else {
+      char literal[16];
+      snprintf(literal, sizeof(literal), "%u", randomLiteral(rng));
+      src += literal;
+    }
+    return;
+  }
+  src += rng.below(2) ? "+ " : "* ";
+  unsigned left = rng.below(ops);
+  randomSource(rng, left, depth - 1, src);
+  src += " ";
+  randomSource(rng, ops - 1 - left, depth - 1, src);
+}
+
+static void shape(const Expr *expr, unsigned depth, unsigned &ops, unsigned &maxDepth) {
+  if (depth > maxDepth) {
+    maxDepth = depth;
+  }
+  if (expr->getOp1()) {
+    ops++;
+    shape(expr->getOp1(), depth + 1, ops, maxDepth);
+    shape(expr->getOp2(), depth + 1, ops, maxDepth);
+  }
+}
+
+static unsigned countInstructions(const llvm::Function *function) {
+  unsigned n = 0;
+  for (llvm::Function::const_iterator BB = function->begin(), E = function->end(); BB != E; ++BB) {
+    n += BB->size();
+  }
+  return n;
+}
+
+// x values every expression is checked on: the edges of int, then random.
+static std::vector<int> makeInputs(Random &rng, size_t n) {
+  static const int edges[] = { 0, 1, -1, 2, -2, 3, 65535, 65536, -65536, INT_MAX, INT_MIN, INT_MIN + 1 };
+  std::vector<int> xs;
+  for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]) && xs.size() < n; ++i) {
+    xs.push_back(edges[i]);
+  }
+  while (xs.size() < n) {
+    xs.push_back((int)(uint32_t)rng.next());
+  }
+  return xs;
+}
+
+namespace {
+  enum Variant { INTERP, RAW, OPT, BATCH, NUM_VARIANTS };
+  const char *const variantNames[NUM_VARIANTS] = { "interp", "raw", "opt", "batch" };
+
+  struct Totals {
+    Totals() : exprs(0), mismatches(0), rawCompile(0), optCompile(0), rawInstrs(0), optInstrs(0) {
+      for (int v = 0; v < NUM_VARIANTS; ++v) {
+        callNs[v] = 0;
+      }
+    }
+    unsigned exprs;
+    unsigned mismatches;
+    double rawCompile;
+    double optCompile;
+    unsigned long rawInstrs;
+    unsigned long optInstrs;
+    double callNs[NUM_VARIANTS];
+  };
+}
+
+// Nanoseconds per element of pass over n elements. Each sample repeats the
+// pass until it takes at least a millisecond; the best of 5 samples counts.
+template <typename Pass>
+static double timePasses(Pass pass, size_t n) {
+  double best = 0;
+  for (int sample = 0; sample < 5; ++sample) {
+    unsigned passes = 0;
+    double start = now(), elapsed;
+    do {
+      pass();
+      ++passes;
+    } while ((elapsed = now() - start) < 1e-3);
+    elapsed /= passes;
+    if (sample == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best * 1e9 / n;
+}
+
+// Nanoseconds per call of fn over xs.
+template <typename Fn>
+static double timeCalls(Fn fn, const std::vector<int> &xs) {
+  volatile int sink = 0;
+  double ns = timePasses([&]() {
+    for (size_t i = 0; i < xs.size(); ++i) {
+      sink += fn(xs[i]);
+    }
+  }, xs.size());
+  (void)sink;
+  return ns;
+}
+
+static int interpret(const Expr *expr, int x) {
+  VarExpr::varInt = x;
+  return expr->eval();
+}
+
+// Checks and times one expression; false on a mismatch.
+static bool runOne(const std::string &src, const std::vector<int> &xs, bool verbose, Totals &totals) {
+  Expr *expr = parseWholeExpr(src);
+  if (!expr) {
+    llvm::errs() << "Cannot parse: " << src << "\n";
+    return false;
+  }
+  unsigned ops = 0, depth = 0;
+  shape(expr, 0, ops, depth);
+
+  llvm::LLVMContext context;
+  llvm::Module *module = new llvm::Module("DiffBench", context);
+  double start = now();
+  llvm::Function *raw = genFunction(module, context, expr, "fun_raw");
+  double rawGen = now() - start;
+  start = now();
+  llvm::Function *opt = genFunction(module, context, expr, "fun_opt");
+  double optGen = now() - start;
+  // Optimized like fun_opt, but only checked and timed per element.
+  llvm::Function *batch = genBatchFunction(module, context, expr);
+  llvm::ExecutionEngine *engine = createEngine(module);
+  if (!engine) {
+    deleteExpr(expr);
+    delete module;
+    return false;
+  }
+  unsigned rawInstrs = countInstructions(raw);
+  start = now();
+  ScalarFn rawFn = (ScalarFn)(intptr_t)getFunctionPointer(engine, raw);
+  double rawCompile = rawGen + now() - start;
+  start = now();
+  optimizeFunction(engine, module, opt);
+  ScalarFn optFn = (ScalarFn)(intptr_t)getFunctionPointer(engine, opt);
+  double optCompile = optGen + now() - start;
+  optimizeFunction(engine, module, batch);
+  BatchFn batchFn = (BatchFn)(intptr_t)getFunctionPointer(engine, batch);
+  unsigned optInstrs = countInstructions(opt);
+
+  std::vector<int> batchOut(xs.size());
+  batchFn(&xs[0], &batchOut[0], xs.size());
+  unsigned bad = 0;
+  for (size_t i = 0; i < xs.size(); ++i) {
+    int want = interpret(expr, xs[i]);
+    int got[NUM_VARIANTS] = { want, rawFn(xs[i]), optFn(xs[i]), batchOut[i] };
+    for (int v = RAW; v < NUM_VARIANTS; ++v) {
+      if (got[v] == want) {
+        continue;
+      }
+      if (bad++ < 3) {
+        llvm::errs() << "MISMATCH x=" << xs[i] << " interp=" << want << " "
+                     << variantNames[v] << "=" << got[v] << ": " << src << "\n";
+      }
+    }
+  }
+
+  double callNs[NUM_VARIANTS];
+  callNs[INTERP] = timeCalls([expr](int x) { return interpret(expr, x); }, xs);
+  callNs[RAW] = timeCalls(rawFn, xs);
+  callNs[OPT] = timeCalls(optFn, xs);
+  callNs[BATCH] = timePasses([&]() { batchFn(&xs[0], &batchOut[0], xs.size()); }, xs.size());
+
+  if (verbose) {
+    printf("%4u %5u %5u %9.1f %9.1f %6u %6u %9.1f %7.2f %7.2f %7.2f %s\n",
+           totals.exprs, ops, depth, rawCompile * 1e6, optCompile * 1e6, rawInstrs, optInstrs,
+           callNs[INTERP], callNs[RAW], callNs[OPT], callNs[BATCH], bad ? "MISMATCH" : "ok");
+  }
+  totals.exprs++;
+  totals.mismatches += bad != 0;
+  totals.rawCompile += rawCompile;
+  totals.optCompile += optCompile;
+  totals.rawInstrs += rawInstrs;
+  totals.optInstrs += optInstrs;
+  for (int v = 0; v < NUM_VARIANTS; ++v) {
+    totals.callNs[v] += callNs[v];
+  }
+  delete engine;
+  deleteExpr(expr);
+  return bad == 0;
+}
+
+typedef std::map<std::string, double> Baseline;
+
+// The first line of a baseline, "params ...", holds the parameters of
+// the run it was recorded from.
+static void readBaseline(const char *path, Baseline &baseline, std::string &params) {
+  std::ifstream in(path);
+  std::string line;
+  if (std::getline(in, line) && line.compare(0, 7, "params ") == 0) {
+    params = line.substr(7);
+  }
+  std::string key;
+  double value;
+  while (in >> key >> value) {
+    baseline[key] = value;
+  }
+}
+
+static void usage() {
+  llvm::errs() << "usage: diff-bench [-exprs N] [-ops N] [-depth D] [-xs N] [-seed S] [-v]\n"
+               << "                  [-baseline file [-update]] [-tolerance PCT] [<expr>]\n";
+}
+
+int main(int argc, char** argv) {
+  unsigned numExprs = 200, maxOps = 64, maxDepth = 12;
+  size_t numXs = 4096;
+  uint64_t seed = 1;
+  bool verbose = false, update = false;
+  double tolerance = 25;
+  const char *baselinePath = NULL;
+  const char *single = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-exprs") && i + 1 < argc) {
+      numExprs = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-ops") && i + 1 < argc) {
+      maxOps = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-depth") && i + 1 < argc) {
+      maxDepth = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-xs") && i + 1 < argc) {
+      numXs = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-seed") && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-v")) {
+      verbose = true;
+    } else if (!strcmp(argv[i], "-baseline") && i + 1 < argc) {
+      baselinePath = argv[++i];
+    } else if (!strcmp(argv[i], "-update")) {
+      update = true;
+    } else if (!strcmp(argv[i], "-tolerance") && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    } else if (argv[i][0] != '-' && !single) {
+      single = argv[i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (numXs == 0 || (update && !baselinePath)) {
+    usage();
+    return 1;
+  }
+
+  char params[256];
+  if (single) {
+    snprintf(params, sizeof(params), "seed %llu xs %zu expr", (unsigned long long)seed, numXs);
+  } else {
+    snprintf(params, sizeof(params), "seed %llu xs %zu exprs %u ops %u depth %u",
+             (unsigned long long)seed, numXs, numExprs, maxOps, maxDepth);
+  }
+  std::string runParams = params;
+  if (single) {
+    runParams += std::string(" ") + single;
+  }
+  Baseline baseline;
+  if (baselinePath && !update) {
+    std::string baseParams;
+    readBaseline(baselinePath, baseline, baseParams);
+    if (baseline.empty()) {
+      llvm::errs() << "no baseline in " << baselinePath << ", create one with -update\n";
+    } else if (baseParams != runParams) {
+      llvm::errs() << baselinePath << " was recorded with '" << baseParams
+                   << "', not '" << runParams << "'; rerun with those or -update\n";
+      return 1;
+    }
+  }
+
+  Random rng(seed);
+  std::vector<int> xs = makeInputs(rng, numXs);
+  if (verbose) {
+    printf("%4s %5s %5s %9s %9s %6s %6s %9s %7s %7s %7s\n", "#", "ops", "depth",
+           "raw us", "opt us", "raw IR", "opt IR",
+           "interp ns", "raw ns", "opt ns", "batch ns");
+  }
+  Totals totals;
+  if (single) {
+    runOne(single, xs, verbose, totals);
+  } else {
+    for (unsigned e = 0; e < numExprs; ++e) {
+      std::string src;
+      randomSource(rng, rng.below(maxOps + 1), maxDepth, src);
+      runOne(src, xs, verbose, totals);
+    }
+  }
+  if (totals.exprs == 0) {
+    return 1;
+  }
+
+  // Means per expression; these are what the baseline holds.
+  Baseline current;
+  current["raw_compile_us"] = totals.rawCompile * 1e6 / totals.exprs;
+  current["opt_compile_us"] = totals.optCompile * 1e6 / totals.exprs;
+  for (int v = 0; v < NUM_VARIANTS; ++v) {
+    current[std::string(variantNames[v]) + "_call_ns"] = totals.callNs[v] / totals.exprs;
+  }
+  printf("%u expressions, %zu x values each, seed %llu: %u mismatches\n",
+         totals.exprs, xs.size(), (unsigned long long)seed, totals.mismatches);
+  printf("IR instructions: %lu raw, %lu optimized\n", totals.rawInstrs, totals.optInstrs);
+
+  unsigned regressions = 0;
+  std::string updated = "params " + runParams + "\n";
+  for (Baseline::iterator i = current.begin(), e = current.end(); i != e; ++i) {
+    printf("%-16s %10.2f", i->first.c_str(), i->second);
+    char line[64];
+    snprintf(line, sizeof(line), " %.3f\n", i->second);
+    updated += i->first + line;
+    Baseline::iterator base = baseline.find(i->first);
+    if (base != baseline.end()) {
+      printf("  (baseline %.2f)", base->second);
+      if (i->second > base->second * (1 + tolerance / 100)) {
+        printf(" REGRESSION");
+        regressions++;
+      }
+    }
+    printf("\n");
+  }
+
+  if (update) {
+    std::ofstream out(baselinePath);
+    out << updated;
+    if (!out) {
+      llvm::errs() << "cannot write " << baselinePath << "\n";
+      return 1;
+    }
+    printf("baseline written to %s\n", baselinePath);
+  }
+  return totals.mismatches || regressions ? 1 : 0;
+}
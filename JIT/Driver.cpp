@@ -1,100 +1,197 @@
-#include "llvm/Analysis/Verifier.h"
+#include <sys/time.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+
 #include "llvm/ADT/APInt.h"
-#include "llvm/Analysis/Passes.h" // this
-#include "llvm/PassManager.h" // this
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
-#include "llvm/ExecutionEngine/JIT.h"
-#include "llvm/IR/DataLayout.h" // this
-#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
-#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Transforms/Scalar.h" // this
 
+#include "Compiler.h"
 #include "Expr.h"
 #include "Lexer.h"
 #include "Parser.h"
+#include "Profiling.h"
+#include "Specialize.h"
 
-llvm::Function *createEntryFunction(
-    llvm::Module *module,
-    llvm::LLVMContext &context) {
-  llvm::Function *function =
-     llvm::cast<llvm::Function>(
-         module->getOrInsertFunction("fun",
-           llvm::Type::getInt32Ty(context),
-           llvm::Type::getInt32Ty(context),
-           (llvm::Type *)0)
-         );
-  llvm::BasicBlock *bb = llvm::BasicBlock::Create(context, "entry", function);
-  llvm::IRBuilder<> builder(context);
-  builder.SetInsertPoint(bb);
-  llvm::Argument *argX = function->arg_begin();
-  argX->setName("x");
-  VarExpr::varValue = argX;
-  Lexer lexer;
-  Parser parser(&lexer);
-  Expr* expr = parser.parseExpr();
-  llvm::Value* retVal = expr->gen(&builder, context);
-  builder.CreateRet(retVal);
-  return function;
+void JIT(llvm::ExecutionEngine* engine, llvm::Function* function, int arg) {
+  std::vector<llvm::GenericValue> Args(1);
+  Args[0].IntVal = llvm::APInt(32, arg);
+  llvm::GenericValue retVal = engine->runFunction(function, Args);
+  llvm::outs() << "Result: " << retVal.IntVal << "\n";
 }
 
-llvm::ExecutionEngine* createEngine(llvm::Module *module) {
-  llvm::InitializeNativeTarget();
-
-  std::string errStr;
-  llvm::ExecutionEngine *engine =
-    llvm::EngineBuilder(module)
-    .setErrorStr(&errStr)
-    .setEngineKind(llvm::EngineKind::JIT)
-    .create();
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
 
-  if (!engine) {
-    llvm::errs() << "Failed to construct ExecutionEngine: " << errStr << "\n";
-  } else if (llvm::verifyModule(*module)) {
-    llvm::errs() << "Error constructing function!\n";
+// Best time of a few passes of fn over xs, in seconds.
+static double timeCalls(ScalarFn fn, const std::vector<int> &xs, unsigned &sink) {
+  double best = 0;
+  for (int rep = 0; rep < 5; ++rep) {
+    double start = now();
+    for (size_t i = 0; i < xs.size(); ++i) {
+      sink += fn(xs[i]);
+    }
+    double elapsed = now() - start;
+    if (rep == 0 || elapsed < best) {
+      best = elapsed;
+    }
   }
-  return engine;
+  return best;
 }
 
-void JIT(llvm::ExecutionEngine* engine, llvm::Function* function, int arg) {
-  std::vector<llvm::GenericValue> Args(1);
-  Args[0].IntVal = llvm::APInt(32, arg);
-  llvm::GenericValue retVal = engine->runFunction(function, Args);
-  llvm::outs() << "Result: " << retVal.IntVal << "\n";
+// Calls fun on the first tenth of the x values in inputPath while sampling
+// them, compiles fun_spec for the distribution seen and swaps it in for
+// the rest if it beats the generic code on the whole input.
+static int specialize(llvm::ExecutionEngine *engine, llvm::Module *module,
+                      llvm::LLVMContext &context, const Expr *expr,
+                      llvm::Function *function, const char *inputPath) {
+  std::ifstream input(inputPath);
+  std::vector<int> xs;
+  for (int x; input >> x;) {
+    xs.push_back(x);
+  }
+  if (xs.empty()) {
+    llvm::errs() << "No x values in " << inputPath << ".\n";
+    return 1;
+  }
+
+  ScalarFn generic = (ScalarFn)getFunctionPointer(engine, function);
+  HotSwapFunction fun(generic);
+  size_t profiled = std::min(xs.size(), std::max<size_t>(xs.size() / 10, 1000));
+  ValueProfile profile;
+  unsigned sink = 0;
+  for (size_t i = 0; i < profiled; ++i) {
+    profile.record(xs[i]);
+    sink += fun(xs[i]);
+  }
+
+  Specialization spec = planSpecialization(profile);
+  llvm::errs() << "Profiled " << profile.getNumCalls() << " calls, "
+               << profile.getSamples().size() << " samples\n";
+  if (spec.hasRange) {
+    llvm::errs() << "  table for x in [" << spec.rangeLo << ", "
+                 << (long long)spec.rangeLo + spec.rangeSpan - 1 << "]\n";
+  }
+  for (size_t i = 0; i < spec.hotValues.size(); ++i) {
+    llvm::errs() << "  hot x = " << spec.hotValues[i].first << " ("
+                 << llvm::format("%.1f%%", 100 * spec.hotValues[i].second) << ")\n";
+  }
+  if (spec.empty()) {
+    llvm::errs() << "No hot values or narrow range, keeping the generic fun.\n";
+    return 0;
+  }
+  llvm::errs() << "  " << llvm::format("%.1f%%", 100 * spec.coverage)
+               << " of the samples take a fast path\n";
+
+  llvm::Function *specialized = genSpecializedFunction(module, context, expr, spec);
+  optimizeFunction(engine, module, specialized);
+  specialized->dump();
+  ScalarFn fast = (ScalarFn)getFunctionPointer(engine, specialized);
+  for (size_t i = 0; i < xs.size(); ++i) {
+    if (fast(xs[i]) != generic(xs[i])) {
+      llvm::errs() << "fun_spec(" << xs[i] << ") = " << fast(xs[i])
+                   << ", fun(" << xs[i] << ") = " << generic(xs[i]) << "\n";
+      return 1;
+    }
+  }
+
+  double genericTime = timeCalls(generic, xs, sink);
+  double fastTime = timeCalls(fast, xs, sink);
+  llvm::outs() << llvm::format("fun      %8.2f ns/call\n", genericTime * 1e9 / xs.size())
+               << llvm::format("fun_spec %8.2f ns/call (%.2fx)\n",
+                               fastTime * 1e9 / xs.size(), genericTime / fastTime);
+  if (fastTime < genericTime) {
+    fun.swap(fast);
+    llvm::outs() << "Swapped in fun_spec.\n";
+  } else {
+    llvm::outs() << "Keeping the generic fun.\n";
+  }
+  for (size_t i = profiled; i < xs.size(); ++i) {
+    sink += fun(xs[i]);
+  }
+  llvm::outs() << "Checksum: " << sink << "\n";
+  return 0;
 }
 
-void optimizeFunction(
-  llvm::ExecutionEngine* engine,
-  llvm::Module *module,
-  llvm::Function* function
-) {
-  llvm::FunctionPassManager passManager(module);
-  passManager.add(new llvm::DataLayout(*engine->getDataLayout()));
-  passManager.add(llvm::createInstructionCombiningPass());
-  passManager.add(llvm::createReassociatePass());
-  passManager.add(llvm::createGVNPass());
-  passManager.add(llvm::createCFGSimplificationPass());
-  passManager.doInitialization();
-  passManager.run(*function);
+static void usage() {
+  llvm::errs() << "usage: driver [--perf-map] [--jitdump] [--count] <x>\n"
+               << "       driver --specialize <file of x values>\n"
+               << "  --perf-map    describe JIT'd code in /tmp/perf-<pid>.map\n"
+               << "  --jitdump     write jit-<pid>.dump for perf inject --jit\n"
+               << "  --count       count calls and cycles of fun and report them\n"
+               << "  --specialize  profile x over the file and specialize fun for it\n";
 }
 
 int main(int argc, char** argv) {
-  if (argc != 2) {
+  unsigned profileOutputs = 0;
+  bool count = false;
+  bool specializing = false;
+  int argi = 1;
+  for (; argi < argc - 1; ++argi) {
+    if (!strcmp(argv[argi], "--perf-map")) {
+      profileOutputs |= JITProfiler::PERF_MAP;
+    } else if (!strcmp(argv[argi], "--jitdump")) {
+      profileOutputs |= JITProfiler::JITDUMP;
+    } else if (!strcmp(argv[argi], "--count")) {
+      count = true;
+    } else if (!strcmp(argv[argi], "--specialize")) {
+      specializing = true;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (argi != argc - 1) {
     llvm::errs() << "Inform an argument to your expression.\n";
+    usage();
     return 1;
   } else {
+    // Reads just the expression, so it can be typed in; what was read
+    // labels the code for the profiler.
+    std::string source;
+    Lexer lexer;
+    lexer.setEcho(&source);
+    Parser parser(&lexer);
+    Expr *expr = parser.parseExpr();
+    if (!expr) {
+      llvm::errs() << "Invalid expression.\n";
+      return 1;
+    }
     llvm::LLVMContext context;
     llvm::Module *module = new llvm::Module("Example", context);
-    llvm::Function *function = createEntryFunction(module, context);
+    llvm::Function *function = genFunction(module, context, expr);
     llvm::errs() << "Module before optimizations:\n";
     module->dump();
     llvm::errs() << "Module after optimizations:\n";
     llvm::ExecutionEngine* engine = createEngine(module);
     optimizeFunction(engine, module, function);
     module->dump();
-    JIT(engine, function, atoi(argv[1]));
+    if (specializing) {
+      int status = specialize(engine, module, context, expr, function, argv[argi]);
+      deleteExpr(expr);
+      return status;
+    }
+    deleteExpr(expr);
+
+    JITProfiler profiler(profileOutputs);
+    profiler.setLabel(function, source);
+    if (count) {
+      profiler.instrument(function);
+    }
+    engine->RegisterJITEventListener(&profiler);
+    JIT(engine, function, atoi(argv[argi]));
+    engine->UnregisterJITEventListener(&profiler);
+    if (count) {
+      profiler.report(llvm::errs());
+    }
   }
 }
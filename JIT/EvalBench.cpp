@@ -0,0 +1,101 @@
+// Scaling report for the parallel evaluator: reads an expression from
+// stdin, JITs the scalar and batch variants, and evaluates them over an
+// array of x values on 1..N threads.
+//   echo "+ * x x 3" | ./eval-bench [elements] [max threads]
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Compiler.h"
+#include "Expr.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "ParallelEval.h"
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Best of a few runs, in seconds.
+template <typename Fn>
+static double timeRun(ParallelEvaluator &eval, Fn fn, const int *in, int *out, size_t n) {
+  double best = 0;
+  for (int rep = 0; rep < 5; ++rep) {
+    double start = now();
+    eval.run(fn, in, out, n);
+    double elapsed = now() - start;
+    if (rep == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 26;
+  unsigned maxThreads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+  if (maxThreads == 0) {
+    maxThreads = 1;
+  }
+
+  Lexer lexer;
+  Parser parser(&lexer);
+  Expr *expr = parser.parseExpr();
+  if (!expr) {
+    llvm::errs() << "Invalid expression.\n";
+    return 1;
+  }
+  llvm::LLVMContext context;
+  llvm::Module *module = new llvm::Module("EvalBench", context);
+  llvm::Function *scalar = genFunction(module, context, expr);
+  llvm::Function *batch = genBatchFunction(module, context, expr);
+  llvm::ExecutionEngine *engine = createEngine(module);
+  if (!engine) {
+    return 1;
+  }
+  optimizeFunction(engine, module, scalar);
+  optimizeFunction(engine, module, batch);
+  ScalarFn scalarFn = (ScalarFn)(intptr_t)getFunctionPointer(engine, scalar);
+  BatchFn batchFn = (BatchFn)(intptr_t)getFunctionPointer(engine, batch);
+
+  std::vector<int> in(n), out(n);
+  for (size_t i = 0; i < n; ++i) {
+    in[i] = (int)(i * 2654435761u);
+  }
+
+  // Reference results from a single-threaded scalar run.
+  std::vector<int> ref(n);
+  ParallelEvaluator serial(1);
+  serial.run(scalarFn, &in[0], &ref[0], n);
+
+  printf("%zu elements\n", n);
+  printf("%8s %12s %10s %8s %12s %10s %8s\n", "threads",
+         "scalar ms", "Melem/s", "speedup", "batch ms", "Melem/s", "speedup");
+  double scalarBase = 0, batchBase = 0;
+  for (unsigned t = 1; t <= maxThreads; ++t) {
+    ParallelEvaluator eval(t);
+    double scalarTime = timeRun(eval, scalarFn, &in[0], &out[0], n);
+    bool ok = out == ref;
+    double batchTime = timeRun(eval, batchFn, &in[0], &out[0], n);
+    ok = ok && out == ref;
+    if (t == 1) {
+      scalarBase = scalarTime;
+      batchBase = batchTime;
+    }
+    printf("%8u %12.2f %10.1f %8.2f %12.2f %10.1f %8.2f%s\n", t,
+           scalarTime * 1e3, n / scalarTime / 1e6, scalarBase / scalarTime,
+           batchTime * 1e3, n / batchTime / 1e6, batchBase / batchTime,
+           ok ? "" : "  MISMATCH");
+  }
+  deleteExpr(expr);
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "EvalClient.h"
+
+using namespace evalipc;
+
+EvalClient::EvalClient()
+  : fd(-1), ring(NULL), ringSize(0), slots(0), slotElems(0), head(0) {}
+
+EvalClient::~EvalClient() {
+  unmapRing();
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void EvalClient::unmapRing() {
+  if (ring) {
+    munmap(ring, ringSize);
+    ring = NULL;
+  }
+}
+
+bool EvalClient::connect(const char *socketPath) {
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+  if (fd < 0 || ::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    error = std::string("cannot connect to ") + socketPath + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool EvalClient::request(const std::string &line, std::string &reply) {
+  std::string out = line + "\n";
+  for (size_t done = 0; done < out.size();) {
+    ssize_t n = write(fd, out.data() + done, out.size() - done);
+    if (n <= 0) {
+      error = "connection lost";
+      return false;
+    }
+    done += n;
+  }
+  size_t newline;
+  while ((newline = pending.find('\n')) == std::string::npos) {
+    char buffer[4096];
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0) {
+      error = "connection lost";
+      return false;
+    }
+    pending.append(buffer, n);
+  }
+  reply = pending.substr(0, newline);
+  pending.erase(0, newline + 1);
+  if (reply.compare(0, 3, "OK ") != 0 && reply != "OK") {
+    error = reply;
+    return false;
+  }
+  reply.erase(0, 3);
+  return true;
+}
+
+int EvalClient::compile(const std::string &expr) {
+  std::string reply;
+  if (expr.find('\n') != std::string::npos || !request("COMPILE " + expr, reply)) {
+    return -1;
+  }
+  return atoi(reply.c_str());
+}
+
+bool EvalClient::openRing(uint32_t numSlots, uint32_t elems) {
+  char line[64];
+  snprintf(line, sizeof(line), "RING %u %u", numSlots, elems);
+  std::string reply;
+  if (!request(line, reply)) {
+    return false;
+  }
+  char name[256];
+  size_t bytes;
+  if (sscanf(reply.c_str(), "%255s %zu", name, &bytes) != 2) {
+    error = "bad RING reply: " + reply;
+    return false;
+  }
+  // Nobody else maps the ring, so the name goes whether or not this works.
+  int shm = shm_open(name, O_RDWR, 0);
+  int openErrno = errno;
+  shm_unlink(name);
+  if (numSlots == 0 || bytes < ringBytes(numSlots, elems)) {
+    if (shm >= 0) {
+      close(shm);
+    }
+    error = "bad RING reply: " + reply;
+    return false;
+  }
+  if (shm < 0) {
+    error = std::string("cannot open ") + name + ": " + strerror(openErrno);
+    return false;
+  }
+  unmapRing();
+  ring = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+  close(shm);
+  if (ring == MAP_FAILED) {
+    ring = NULL;
+    error = std::string("cannot map ") + name + ": " + strerror(errno);
+    return false;
+  }
+  ringSize = bytes;
+  slots = numSlots;
+  slotElems = elems;
+  head = 0;
+  return true;
+}
+
+std::string EvalClient::stats(int exprId) {
+  std::string line = "STATS", reply;
+  if (exprId >= 0) {
+    char id[16];
+    snprintf(id, sizeof(id), " %d", exprId);
+    line += id;
+  }
+  return request(line, reply) ? reply : error;
+}
+
+// The server never writes to the socket unprompted, so a hang-up or
+// anything readable while a request is out means it is gone.
+bool EvalClient::serverGone() {
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  if (poll(&p, 1, 0) <= 0) {
+    return false;
+  }
+  char c;
+  if ((p.revents & (POLLHUP | POLLERR)) ||
+      recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0) {
+    error = "server closed the connection";
+    return true;
+  }
+  return false;
+}
+
+bool EvalClient::waitFor(Slot *slot, uint32_t state) {
+  Backoff backoff;
+  // Polling costs a syscall, so the socket is only looked at every 64 rounds.
+  for (unsigned round = 1; slot->state.load(std::memory_order_acquire) != state; ++round) {
+    if (round % 64 == 0 && serverGone()) {
+      return false;
+    }
+    backoff.wait();
+  }
+  return true;
+}
+
+int32_t *EvalClient::acquire() {
+  Slot *slot = slotAt(head);
+  return waitFor(slot, SLOT_FREE) ? slotData(slot) : NULL;
+}
+
+uint32_t EvalClient::submit(uint32_t exprId, uint32_t n) {
+  Slot *slot = slotAt(head);
+  slot->exprId = exprId;
+  slot->n = n;
+  slot->submitNs = monotonicNs();
+  slot->state.store(SLOT_SUBMITTED, std::memory_order_release);
+  return head++;
+}
+
+const int32_t *EvalClient::wait(uint32_t ticket, int *status) {
+  Slot *slot = slotAt(ticket);
+  if (!waitFor(slot, SLOT_DONE)) {
+    return NULL;
+  }
+  if (status) {
+    *status = slot->status;
+  }
+  return slotData(slot);
+}
+
+void EvalClient::release(uint32_t ticket) {
+  slotAt(ticket)->state.store(SLOT_FREE, std::memory_order_release);
+}
@@ -0,0 +1,65 @@
+#ifndef EVAL_CLIENT_H
+#define EVAL_CLIENT_H
+
+#include <stdint.h>
+#include <string>
+
+#include "EvalProtocol.h"
+
+// Client side of eval-server; needs neither LLVM nor the expression
+// parser. Requests are pipelined: up to one per ring slot can be in flight.
+//   EvalClient client;
+//   client.connect(evalipc::DEFAULT_SOCKET);
+//   int id = client.compile("+ * x x 3");
+//   client.openRing(64, 4096);
+//   int32_t *xs = client.acquire();         // fill up to 4096 values
+//   uint32_t ticket = client.submit(id, n);
+//   const int32_t *results = client.wait(ticket, &status);
+//   client.release(ticket);
+class EvalClient {
+  public:
+    EvalClient();
+    ~EvalClient();
+
+    bool connect(const char *socketPath);
+    // Id of the compiled expression, -1 if it does not parse.
+    int compile(const std::string &expr);
+    bool openRing(uint32_t numSlots, uint32_t slotElems);
+    // Raw STATS reply.
+    std::string stats(int exprId = -1);
+
+    // Input buffer of the next slot, once the server is done with it;
+    // NULL if the server went away meanwhile.
+    int32_t *acquire();
+    // Submits the first n values of the acquired slot; returns its ticket.
+    uint32_t submit(uint32_t exprId, uint32_t n);
+    // Results of a submitted request, in place of its inputs; NULL if the
+    // server went away before answering.
+    const int32_t *wait(uint32_t ticket, int *status);
+    // Hands a waited-for slot back for reuse.
+    void release(uint32_t ticket);
+
+    uint32_t getSlotElems() const { return slotElems; }
+    const std::string &getError() const { return error; }
+
+  private:
+    bool request(const std::string &line, std::string &reply);
+    void unmapRing();
+    evalipc::Slot *slotAt(uint32_t index) const {
+      return evalipc::slotAt(ring, slots, evalipc::slotBytes(slotElems), index);
+    }
+    // Waits for the slot to reach the state, watching the control socket.
+    bool waitFor(evalipc::Slot *slot, uint32_t state);
+    bool serverGone();
+
+    int fd;
+    void *ring;
+    size_t ringSize;
+    uint32_t slots;
+    uint32_t slotElems;
+    uint32_t head;
+    std::string pending;
+    std::string error;
+};
+
+#endif
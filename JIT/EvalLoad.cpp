@@ -0,0 +1,103 @@
+// Load generator for eval-server: keeps a number of requests in flight
+// for a while and reports throughput, request latency as seen by the
+// client and the server's own counters.
+//   ./eval-load [-socket path] [-batch N] [-inflight K] [-seconds S] "+ * x x 3"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "EvalClient.h"
+
+static void usage() {
+  fprintf(stderr, "usage: eval-load [-socket <path>] [-batch <n>] [-inflight <k>] "
+                  "[-seconds <s>] <expression>\n");
+}
+
+int main(int argc, char** argv) {
+  const char *socketPath = evalipc::DEFAULT_SOCKET;
+  unsigned batch = 1024, inflight = 8;
+  double seconds = 5;
+  const char *expr = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-socket") && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if (!strcmp(argv[i], "-batch") && i + 1 < argc) {
+      batch = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "-inflight") && i + 1 < argc) {
+      inflight = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "-seconds") && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (argv[i][0] != '-' && !expr) {
+      expr = argv[i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (!expr) {
+    usage();
+    return 1;
+  }
+
+  EvalClient client;
+  int id;
+  if (!client.connect(socketPath) || (id = client.compile(expr)) < 0 ||
+      !client.openRing(inflight, batch)) {
+    fprintf(stderr, "%s\n", client.getError().c_str());
+    return 1;
+  }
+
+  // Ticket t is submitted at starts[t % inflight].
+  std::vector<uint64_t> starts(inflight);
+  std::vector<uint64_t> latencies;
+  uint64_t begin = evalipc::monotonicNs();
+  uint64_t end = begin + (uint64_t)(seconds * 1e9);
+  uint32_t submitted = 0, completed = 0;
+  unsigned errors = 0;
+  int32_t x = 0;
+  while (true) {
+    uint64_t now = evalipc::monotonicNs();
+    if (now < end && submitted - completed < inflight) {
+      int32_t *xs = client.acquire();
+      if (!xs) {
+        fprintf(stderr, "%s\n", client.getError().c_str());
+        return 1;
+      }
+      for (unsigned i = 0; i < batch; ++i) {
+        xs[i] = x++;
+      }
+      starts[submitted % inflight] = evalipc::monotonicNs();
+      client.submit(id, batch);
+      ++submitted;
+      continue;
+    }
+    if (completed == submitted) {
+      break;
+    }
+    int status;
+    if (!client.wait(completed, &status)) {
+      fprintf(stderr, "%s\n", client.getError().c_str());
+      return 1;
+    }
+    latencies.push_back(evalipc::monotonicNs() - starts[completed % inflight]);
+    errors += status != evalipc::STATUS_OK;
+    client.release(completed++);
+  }
+  double elapsed = (evalipc::monotonicNs() - begin) / 1e9;
+
+  std::sort(latencies.begin(), latencies.end());
+  size_t count = latencies.size();
+  printf("%zu requests of %u values in %.2f s, %u failed\n", count, batch, elapsed, errors);
+  if (count) {
+    printf("%.0f requests/s, %.0f values/s\n", count / elapsed, count * batch / elapsed);
+    printf("latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           latencies[count / 2] / 1e3, latencies[count * 99 / 100] / 1e3,
+           latencies[count - 1] / 1e3);
+  }
+  printf("server: %s\n", client.stats().c_str());
+  printf("expression %d: %s\n", id, client.stats(id).c_str());
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+#ifndef EVAL_PROTOCOL_H
+#define EVAL_PROTOCOL_H
+
+// Wire format between eval-server and its clients.
+//
+// Control goes over a Unix stream socket as text lines, one reply line per
+// request:
+//   COMPILE <prefix expression>  -> OK <id>
+//   RING <slots> <slot elems>    -> OK <shm name> <bytes>
+//   STATS [<id>]                 -> OK <key>=<value> ...
+// and ERR <message> on failure. RING gives the connection a ring buffer in
+// shared memory; the client maps it by name and unlinks the name.
+//
+// Data goes through the ring without further copies: the client writes x
+// values into the next free slot and marks it SUBMITTED, the server
+// evaluates them in place and marks it DONE, and the client reads the
+// results and marks it FREE again. Slots are used in order, so each side
+// only needs its own index.
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <cstddef>
+
+namespace evalipc {
+
+static const char *const DEFAULT_SOCKET = "/tmp/eval-server.sock";
+static const uint32_t RING_MAGIC = 0x52494e47;
+static const size_t CACHE_LINE = 64;
+
+enum SlotState {
+  SLOT_FREE = 0,
+  SLOT_SUBMITTED = 1,
+  SLOT_DONE = 2
+};
+
+enum SlotStatus {
+  STATUS_OK = 0,
+  STATUS_BAD_EXPR = 1,
+  STATUS_BAD_SIZE = 2
+};
+
+struct RingHeader {
+  uint32_t magic;
+  uint32_t slots;
+  uint32_t slotElems;
+  uint32_t slotBytes;
+};
+
+// Followed by slotElems int32 values: x on submission, results when DONE.
+struct Slot {
+  std::atomic<uint32_t> state;
+  uint32_t exprId;
+  uint32_t n;
+  int32_t status;
+  // CLOCK_MONOTONIC time of submission, for the server's latency counters.
+  uint64_t submitNs;
+};
+
+inline size_t slotBytes(uint32_t slotElems) {
+  size_t bytes = sizeof(Slot) + slotElems * sizeof(int32_t);
+  return (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+inline size_t ringBytes(uint32_t slots, uint32_t slotElems) {
+  return CACHE_LINE + slots * slotBytes(slotElems);
+}
+
+inline Slot *slotAt(void *ring, uint32_t slots, size_t slotBytes, uint32_t index) {
+  return reinterpret_cast<Slot *>(
+      static_cast<char *>(ring) + CACHE_LINE + (size_t)(index % slots) * slotBytes);
+}
+
+inline int32_t *slotData(Slot *slot) {
+  return reinterpret_cast<int32_t *>(slot + 1);
+}
+
+inline uint64_t monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Polling back-off for both sides of a ring: spins first, then sleeps for
+// up to 1ms, so an idle ring costs next to no CPU.
+class Backoff {
+  public:
+    Backoff() : rounds(0) {}
+    void reset() { rounds = 0; }
+    void wait() {
+      if (++rounds < 1000) {
+        return;
+      }
+      struct timespec ts = { 0, rounds < 2000 ? 20000 : 1000000 };
+      nanosleep(&ts, NULL);
+    }
+  private:
+    unsigned rounds;
+};
+
+}
+
+#endif
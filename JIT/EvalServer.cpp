@@ -0,0 +1,450 @@
+// Long-running evaluation server: keeps compiled expressions resident and
+// evaluates batches of x values that clients put in shared-memory rings
+// (see EvalProtocol.h), so a request costs neither a process start nor
+// LLVM initialization, parsing or code generation.
+//   ./eval-server [-socket /tmp/eval-server.sock] [-threads N]
+// Each connection gets a control thread and, once it asks for a ring, a
+// thread draining that ring. Requests of at least PARALLEL_MIN_ELEMS are
+// split over the shared ParallelEvaluator of N threads.
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Compiler.h"
+#include "EvalProtocol.h"
+#include "Expr.h"
+#include "ParallelEval.h"
+#include "Parser.h"
+#include "PooledMemoryManager.h"
+
+using namespace evalipc;
+
+namespace {
+  struct Compiled {
+    std::string source;
+    llvm::ExecutionEngine *engine;
+    BatchFn batch;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> elements;
+    std::atomic<uint64_t> evalNs;
+  };
+
+  struct Counters {
+    uint64_t startNs;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> elements;
+    std::atomic<uint64_t> evalNs;
+    // Times a ring thread woke up to find requests; requests / drains is
+    // the batching achieved.
+    std::atomic<uint64_t> drains;
+    std::atomic<uint64_t> errors;
+    // Submission to completion; bucket b counts latencies < 2^b ns.
+    std::atomic<uint64_t> latency[64];
+  };
+
+  // Compiled expressions by id. Ids are handed out in order and entries
+  // are never removed, so lookups need no lock.
+  class ExprTable {
+    public:
+      ExprTable() : count(0) {}
+
+      // Id of source, compiling it the first time; -1 and err on failure.
+      int compile(const std::string &source, std::string &err);
+      Compiled *get(uint32_t id) const {
+        return id < count.load(std::memory_order_acquire) ? entries[id] : NULL;
+      }
+      size_t size() const { return count.load(std::memory_order_acquire); }
+
+      static const size_t MAX_EXPRS = 1 << 16;
+
+    private:
+      // LLVM is not thread-safe; every compilation holds this.
+      std::mutex lock;
+      llvm::LLVMContext context;
+      // Code of every expression, packed; finalized code keeps running
+      // while the next expression is emitted.
+      SlabPool pool;
+      std::map<std::string, int> ids;
+      Compiled *entries[MAX_EXPRS];
+      std::atomic<size_t> count;
+  };
+
+  // A connection's ring and the thread draining it.
+  class Ring {
+    public:
+      Ring(ExprTable &table, Counters &counters, ParallelEvaluator &evaluator,
+           std::mutex &evaluatorLock)
+        : table(table), counters(counters), evaluator(evaluator),
+          evaluatorLock(evaluatorLock), mem(NULL), bytes(0), slots(0), slotSize(0),
+          elems(0), tail(0), stopping(false) {}
+      ~Ring();
+
+      bool create(const std::string &name, uint32_t numSlots, uint32_t slotElems, std::string &err);
+
+      static const uint32_t MAX_SLOTS = 4096;
+      static const size_t MAX_BYTES = (size_t)1 << 30;
+      static const uint32_t PARALLEL_MIN_ELEMS = 1 << 16;
+
+    private:
+      void run();
+      void process(Slot *slot);
+      // From the geometry given to create, not the client-writable header.
+      Slot *slotAt(uint32_t index) const { return evalipc::slotAt(mem, slots, slotSize, index); }
+
+      ExprTable &table;
+      Counters &counters;
+      ParallelEvaluator &evaluator;
+      std::mutex &evaluatorLock;
+      std::string shmName;
+      void *mem;
+      size_t bytes;
+      uint32_t slots;
+      size_t slotSize;
+      uint32_t elems;
+      uint32_t tail;
+      std::atomic<bool> stopping;
+      std::thread worker;
+  };
+}
+
+static std::string trim(const std::string &s) {
+  size_t begin = s.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+
+int ExprTable::compile(const std::string &source, std::string &err) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::map<std::string, int>::iterator it = ids.find(source);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  size_t id = count.load(std::memory_order_relaxed);
+  if (id == MAX_EXPRS) {
+    err = "too many expressions";
+    return -1;
+  }
+  Expr *expr = parseWholeExpr(source);
+  if (!expr) {
+    err = "invalid expression";
+    return -1;
+  }
+  llvm::Module *module = new llvm::Module("eval-server", context);
+  llvm::Function *function = genBatchFunction(module, context, expr);
+  deleteExpr(expr);
+  llvm::ExecutionEngine *engine = createEngine(module, &pool);
+  if (!engine) {
+    delete module;
+    err = "cannot create an execution engine";
+    return -1;
+  }
+  optimizeFunction(engine, module, function);
+
+  Compiled *compiled = new Compiled();
+  compiled->source = source;
+  compiled->engine = engine;
+  compiled->batch = (BatchFn)getFunctionPointer(engine, function);
+  entries[id] = compiled;
+  ids[source] = id;
+  count.store(id + 1, std::memory_order_release);
+  return id;
+}
+
+Ring::~Ring() {
+  stopping.store(true, std::memory_order_relaxed);
+  if (worker.joinable()) {
+    worker.join();
+  }
+  if (mem) {
+    munmap(mem, bytes);
+  }
+  // The client unlinks the name once mapped; this covers clients that
+  // never got that far.
+  if (!shmName.empty()) {
+    shm_unlink(shmName.c_str());
+  }
+}
+
+bool Ring::create(const std::string &name, uint32_t numSlots, uint32_t slotElems, std::string &err) {
+  if (numSlots == 0 || numSlots > MAX_SLOTS || slotElems == 0 || slotElems > MAX_BYTES ||
+      ringBytes(numSlots, slotElems) > MAX_BYTES) {
+    err = "ring too large or empty";
+    return false;
+  }
+  slots = numSlots;
+  slotSize = slotBytes(slotElems);
+  bytes = ringBytes(slots, slotElems);
+  int shm = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (shm < 0) {
+    err = std::string("shm_open: ") + strerror(errno);
+    return false;
+  }
+  shmName = name;
+  if (ftruncate(shm, bytes) != 0) {
+    err = std::string("ftruncate: ") + strerror(errno);
+    close(shm);
+    return false;
+  }
+  mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+  close(shm);
+  if (mem == MAP_FAILED) {
+    mem = NULL;
+    err = std::string("mmap: ") + strerror(errno);
+    return false;
+  }
+  RingHeader *header = static_cast<RingHeader *>(mem);
+  header->magic = RING_MAGIC;
+  header->slots = slots;
+  header->slotElems = slotElems;
+  header->slotBytes = slotSize;
+  for (uint32_t i = 0; i < slots; ++i) {
+    new (&slotAt(i)->state) std::atomic<uint32_t>(SLOT_FREE);
+  }
+  elems = slotElems;
+  worker = std::thread(&Ring::run, this);
+  return true;
+}
+
+void Ring::run() {
+  Backoff backoff;
+  while (!stopping.load(std::memory_order_relaxed)) {
+    Slot *next = slotAt(tail);
+    if (next->state.load(std::memory_order_acquire) != SLOT_SUBMITTED) {
+      backoff.wait();
+      continue;
+    }
+    backoff.reset();
+    counters.drains++;
+    // Everything submitted so far is handled in this wakeup.
+    do {
+      process(next);
+      next = slotAt(++tail);
+    } while (next->state.load(std::memory_order_acquire) == SLOT_SUBMITTED);
+  }
+}
+
+void Ring::process(Slot *slot) {
+  uint64_t start = monotonicNs();
+  Compiled *compiled = table.get(slot->exprId);
+  uint32_t n = slot->n;
+  // The slot is client-writable; decide on local copies only.
+  int status = STATUS_OK;
+  if (!compiled) {
+    status = STATUS_BAD_EXPR;
+  } else if (n > elems) {
+    status = STATUS_BAD_SIZE;
+  } else {
+    int32_t *data = slotData(slot);
+    if (n >= PARALLEL_MIN_ELEMS && evaluatorLock.try_lock()) {
+      evaluator.run(compiled->batch, data, data, n);
+      evaluatorLock.unlock();
+    } else {
+      compiled->batch(data, data, n);
+    }
+  }
+  slot->status = status;
+  uint64_t end = monotonicNs();
+  if (status == STATUS_OK) {
+    compiled->requests++;
+    compiled->elements += n;
+    compiled->evalNs += end - start;
+    counters.requests++;
+    counters.elements += n;
+    counters.evalNs += end - start;
+  } else {
+    counters.errors++;
+  }
+  uint64_t latency = end > slot->submitNs ? end - slot->submitNs : 0;
+  unsigned bucket = 0;
+  while (bucket < 63 && (latency >> bucket) != 0) {
+    ++bucket;
+  }
+  counters.latency[bucket]++;
+  slot->state.store(SLOT_DONE, std::memory_order_release);
+}
+
+// Upper bound of the bucket holding the given fraction of requests, in us.
+static double latencyPercentile(const Counters &counters, double fraction) {
+  uint64_t total = 0;
+  for (unsigned b = 0; b < 64; ++b) {
+    total += counters.latency[b];
+  }
+  uint64_t seen = 0;
+  for (unsigned b = 0; b < 64; ++b) {
+    seen += counters.latency[b];
+    if (total && seen >= fraction * total) {
+      return (double)((uint64_t)1 << b) / 1e3;
+    }
+  }
+  return 0;
+}
+
+static std::string statsReply(const ExprTable &table, const Counters &counters, const char *arg) {
+  char reply[512];
+  if (*arg) {
+    Compiled *compiled = table.get(atoi(arg));
+    if (!compiled) {
+      return "ERR unknown expression";
+    }
+    uint64_t elements = compiled->elements;
+    snprintf(reply, sizeof(reply),
+             "OK requests=%llu elements=%llu eval_ns_per_elem=%.2f source=%s",
+             (unsigned long long)compiled->requests, (unsigned long long)elements,
+             elements ? (double)compiled->evalNs / elements : 0.0, compiled->source.c_str());
+    return reply;
+  }
+  double uptime = (monotonicNs() - counters.startNs) / 1e9;
+  uint64_t requests = counters.requests, elements = counters.elements;
+  snprintf(reply, sizeof(reply),
+           "OK uptime_s=%.1f exprs=%zu requests=%llu elements=%llu errors=%llu "
+           "requests_per_drain=%.2f elems_per_s=%.0f eval_ns_per_elem=%.2f "
+           "p50_us=%.1f p99_us=%.1f",
+           uptime, table.size(), (unsigned long long)requests, (unsigned long long)elements,
+           (unsigned long long)counters.errors,
+           counters.drains ? (double)requests / counters.drains : 0.0,
+           uptime > 0 ? elements / uptime : 0.0,
+           elements ? (double)counters.evalNs / elements : 0.0,
+           latencyPercentile(counters, 0.5), latencyPercentile(counters, 0.99));
+  return reply;
+}
+
+static bool writeLine(int fd, const std::string &line) {
+  std::string out = line + "\n";
+  for (size_t done = 0; done < out.size();) {
+    ssize_t n = write(fd, out.data() + done, out.size() - done);
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+static ExprTable *table;
+static Counters counters;
+static ParallelEvaluator *evaluator;
+static std::mutex evaluatorLock;
+static std::atomic<unsigned> numRings(0);
+static const char *socketPath = DEFAULT_SOCKET;
+
+static void serveClient(int fd) {
+  Ring *ring = NULL;
+  std::string pending;
+  char buffer[4096];
+  bool open = true;
+  while (open) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0) {
+      break;
+    }
+    pending.append(buffer, n);
+    size_t newline;
+    while (open && (newline = pending.find('\n')) != std::string::npos) {
+      std::string line = trim(pending.substr(0, newline));
+      pending.erase(0, newline + 1);
+      std::string reply, err;
+      if (line.compare(0, 8, "COMPILE ") == 0) {
+        int id = table->compile(trim(line.substr(8)), err);
+        reply = id < 0 ? "ERR " + err : "OK " + llvm::utostr(id);
+      } else if (line.compare(0, 5, "RING ") == 0) {
+        unsigned slots = 0, slotElems = 0;
+        sscanf(line.c_str() + 5, "%u %u", &slots, &slotElems);
+        char name[64];
+        snprintf(name, sizeof(name), "/eval-server-%d-%u", (int)getpid(), numRings++);
+        delete ring;
+        ring = new Ring(*table, counters, *evaluator, evaluatorLock);
+        if (ring->create(name, slots, slotElems, err)) {
+          reply = std::string("OK ") + name + " " + llvm::utostr(ringBytes(slots, slotElems));
+        } else {
+          delete ring;
+          ring = NULL;
+          reply = "ERR " + err;
+        }
+      } else if (line == "STATS" || line.compare(0, 6, "STATS ") == 0) {
+        reply = statsReply(*table, counters, line.c_str() + 5 + (line.size() > 5));
+      } else {
+        reply = "ERR unknown request";
+      }
+      open = writeLine(fd, reply);
+    }
+  }
+  delete ring;
+  close(fd);
+}
+
+static void onSignal(int) {
+  unlink(socketPath);
+  _exit(0);
+}
+
+static void usage() {
+  llvm::errs() << "usage: eval-server [-socket <path>] [-threads <n>]\n";
+}
+
+int main(int argc, char** argv) {
+  unsigned threads = std::thread::hardware_concurrency();
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-socket") && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+  unlink(socketPath);
+  if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listener, 64) != 0) {
+    llvm::errs() << "Cannot listen on " << socketPath << ": " << strerror(errno) << "\n";
+    return 1;
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  table = new ExprTable();
+  counters.startNs = monotonicNs();
+  evaluator = new ParallelEvaluator(threads ? threads : 1);
+  llvm::errs() << "Listening on " << socketPath << "\n";
+  while (true) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      llvm::errs() << "accept: " << strerror(errno) << "\n";
+      break;
+    }
+    std::thread(serveClient, fd).detach();
+  }
+  unlink(socketPath);
+  return 1;
+}
@@ -1,6 +1,9 @@
+#include <vector>
+
 #include "Expr.h"
 
 llvm::Value* VarExpr::varValue = NULL;
+int VarExpr::varInt = 0;
 
 llvm::Value* NumExpr::gen
 (llvm::IRBuilder<> *builder, llvm::LLVMContext &context) const {
@@ -27,3 +30,21 @@ llvm::Value* MulExpr::gen
   llvm::Value* v2 = op2->gen(builder, context);
   return builder->CreateMul(v1, v2, "multmp");
 }
+
+void deleteExpr(const Expr *expr) {
+  std::vector<const Expr*> worklist;
+  if (expr) {
+    worklist.push_back(expr);
+  }
+  while (!worklist.empty()) {
+    const Expr *e = worklist.back();
+    worklist.pop_back();
+    if (e->getOp1()) {
+      worklist.push_back(e->getOp1());
+    }
+    if (e->getOp2()) {
+      worklist.push_back(e->getOp2());
+    }
+    delete e;
+  }
+}
@@ -8,8 +8,14 @@ class Expr {
     virtual ~Expr() {}
     virtual int eval() const = 0;
     virtual llvm::Value *gen(llvm::IRBuilder<> *builder, llvm::LLVMContext& con) const = 0;
+    // Operands of binary expressions, NULL for leaves.
+    virtual const Expr *getOp1() const { return NULL; }
+    virtual const Expr *getOp2() const { return NULL; }
 };
 
+// Deletes a whole expression tree without recursing on its depth.
+void deleteExpr(const Expr *expr);
+
 class NumExpr : public Expr {
   public:
     NumExpr(int argNum) : num(argNum) {}
@@ -22,16 +28,21 @@ class NumExpr : public Expr {
 
 class VarExpr : public Expr {
   public:
-    int eval() const { return 0; }
+    int eval() const { return varInt; }
     llvm::Value *gen(llvm::IRBuilder<> *builder, llvm::LLVMContext& con) const;
     static llvm::Value* varValue;
+    // Value of x for eval().
+    static int varInt;
 };
 
 class AddExpr : public Expr {
   public:
     AddExpr(Expr* op1Arg, Expr* op2Arg) : op1(op1Arg), op2(op2Arg) {}
-    int eval() const { return op1->eval() + op2->eval(); }
+    // Wraps like the generated i32 code.
+    int eval() const { return (int)((unsigned)op1->eval() + (unsigned)op2->eval()); }
     llvm::Value *gen(llvm::IRBuilder<> *builder, llvm::LLVMContext& con) const;
+    const Expr *getOp1() const { return op1; }
+    const Expr *getOp2() const { return op2; }
   private:
     const Expr* op1;
     const Expr* op2;
@@ -40,8 +51,10 @@ class AddExpr : public Expr {
 class MulExpr : public Expr {
   public:
     MulExpr(Expr* op1Arg, Expr* op2Arg) : op1(op1Arg), op2(op2Arg) {}
-    int eval() const { return op1->eval() * op2->eval(); }
+    int eval() const { return (int)((unsigned)op1->eval() * (unsigned)op2->eval()); }
     llvm::Value *gen(llvm::IRBuilder<> *builder, llvm::LLVMContext& con) const;
+    const Expr *getOp1() const { return op1; }
+    const Expr *getOp2() const { return op2; }
   private:
     const Expr* op1;
     const Expr* op2;
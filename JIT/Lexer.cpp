@@ -1,19 +1,19 @@
+#include <cctype>
 #include "Lexer.h"
-std::string Lexer::getToken() {
-  while (isspace(lastChar)) { lastChar = getchar(); }
+Lexer::Token Lexer::getToken() {
+  while (isspace(lastChar)) { lastChar = readChar(); }
+  Token tk = { TK_UNKNOWN, 0 };
   if (isalpha(lastChar)) {
-    std::string idStr;
-    do { idStr += getNextChar(); } while (isalnum(lastChar));
-    return idStr;
+    tk.kind = lastChar == 'x' ? TK_VAR : TK_UNKNOWN;
+    do { getNextChar(); } while (isalnum(lastChar));
   } else if (isdigit(lastChar)) {
-    std::string numStr;
-    do { numStr += getNextChar(); } while (isdigit(lastChar));
-    return numStr;
+    tk.kind = TK_NUM;
+    do { tk.num = tk.num * 10 + (getNextChar() - '0'); } while (isdigit(lastChar));
   } else if (lastChar == EOF) {
-    return "";
+    tk.kind = TK_EOF;
   } else {
-    std::string operatorStr;
-    operatorStr = getNextChar();
-    return operatorStr;
+    int c = getNextChar();
+    tk.kind = c == '+' ? TK_ADD : c == '*' ? TK_MUL : TK_UNKNOWN;
   }
+  return tk;
 }
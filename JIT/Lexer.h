@@ -1,17 +1,40 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <cstdio>
 #include <string>
 
 class Lexer {
   public:
-    std::string getToken();
-    Lexer() : lastChar(' ') {}
+    enum TokenKind { TK_EOF, TK_NUM, TK_VAR, TK_ADD, TK_MUL, TK_UNKNOWN };
+    struct Token {
+      TokenKind kind;
+      int num;
+    };
+    Token getToken();
+    // Reads from stdin.
+    Lexer() : lastChar(' '), input(stdin), cur(NULL), end(NULL), echo(NULL) {}
+    // Reads from the buffer [begin, end), which must outlive the lexer.
+    Lexer(const char *begin, const char *end)
+      : lastChar(' '), input(NULL), cur(begin), end(end), echo(NULL) {}
+    // Appends every character read from stdin to text, one past the last
+    // token included.
+    void setEcho(std::string *text) { echo = text; }
   private:
-    char lastChar;
-    inline char getNextChar() {
-      char c = lastChar;
-      lastChar = getchar();
+    int lastChar;
+    FILE *input;
+    const char *cur;
+    const char *end;
+    std::string *echo;
+    inline int readChar() {
+      if (!input) { return cur != end ? (unsigned char)*cur++ : EOF; }
+      int c = getc(input);
+      if (echo && c != EOF) { echo->push_back((char)c); }
+      return c;
+    }
+    inline int getNextChar() {
+      int c = lastChar;
+      lastChar = readChar();
       return c;
     }
 };
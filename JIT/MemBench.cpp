@@ -0,0 +1,91 @@
+// Memory footprint of many small compiled expressions, each in its own
+// module and engine:
+//   ./mem-bench [expressions]          pooled MCJIT memory
+//   ./mem-bench [expressions] --jit    one JIT engine per expression
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include "Compiler.h"
+#include "Expr.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "PooledMemoryManager.h"
+
+typedef int (*ScalarFn)(int);
+
+static double maxRSSMB() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1e6;
+#else
+  return usage.ru_maxrss / 1e3;
+#endif
+}
+
+int main(int argc, char** argv) {
+  unsigned count = argc > 1 ? atoi(argv[1]) : 10000;
+  bool pooled = !(argc > 2 && !strcmp(argv[2], "--jit"));
+
+  llvm::LLVMContext context;
+  SlabPool pool;
+  std::vector<llvm::ExecutionEngine*> engines;
+  double rssBefore = maxRSSMB();
+  for (unsigned i = 0; i < count; ++i) {
+    char src[64];
+    int len = snprintf(src, sizeof(src), "+ * x %u * x + x %u", i % 97, i);
+    Lexer lexer(src, src + len);
+    Parser parser(&lexer);
+    Expr *expr = parser.parseExpr();
+    llvm::Module *module = new llvm::Module("MemBench", context);
+    llvm::Function *function = genFunction(module, context, expr);
+    llvm::ExecutionEngine *engine = createEngine(module, pooled ? &pool : NULL);
+    if (!engine) {
+      return 1;
+    }
+    optimizeFunction(engine, module, function);
+    ScalarFn fn = (ScalarFn)(intptr_t)getFunctionPointer(engine, function);
+    int a = i % 97, b = i;
+    if (fn(3) != 3 * a + 3 * (3 + b)) {
+      fprintf(stderr, "wrong result for '%s'\n", src);
+      return 1;
+    }
+    deleteExpr(expr);
+    engines.push_back(engine);
+  }
+  double rssAfter = maxRSSMB();
+
+  printf("%u expressions, %s\n", count, pooled ? "pooled MCJIT memory" : "JIT engine per expression");
+  printf("max RSS growth: %.1f MB (%.0f bytes/expression)\n",
+         rssAfter - rssBefore, (rssAfter - rssBefore) * 1e6 / count);
+  if (pooled) {
+    printf("pool: %u slabs, %zu bytes mapped, %zu bytes live\n",
+           pool.getNumSlabs(), pool.getMappedBytes(), pool.getLiveBytes());
+    printf("per expression: %.0f bytes mapped, %.0f bytes live\n",
+           (double)pool.getMappedBytes() / count, (double)pool.getLiveBytes() / count);
+  }
+
+  // Dropping engines hands their memory back; empty slabs are unmapped.
+  for (size_t i = 0; i < engines.size(); i += 2) {
+    delete engines[i];
+  }
+  if (pooled) {
+    printf("after removing half: %u slabs, %zu bytes mapped, %zu bytes live\n",
+           pool.getNumSlabs(), pool.getMappedBytes(), pool.getLiveBytes());
+  }
+  for (size_t i = 1; i < engines.size(); i += 2) {
+    delete engines[i];
+  }
+  if (pooled) {
+    printf("after removing all: %u slabs, %zu bytes mapped\n",
+           pool.getNumSlabs(), pool.getMappedBytes());
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <stdint.h>
+
+#include "ParallelEval.h"
+
+ParallelEvaluator::ParallelEvaluator(unsigned argNumThreads)
+  : numThreads(std::max(1u, argNumThreads)),
+    ranges(new Range[std::max(1u, argNumThreads)]),
+    scalarFn(NULL), batchFn(NULL), input(NULL), output(NULL),
+    numElems(0), headElems(0), numChunks(0),
+    generation(0), busyWorkers(0), shutdown(false) {
+  for (unsigned i = 1; i < numThreads; ++i) {
+    threads.push_back(std::thread(&ParallelEvaluator::workerLoop, this, i));
+  }
+}
+
+ParallelEvaluator::~ParallelEvaluator() {
+  {
+    std::lock_guard<std::mutex> guard(jobLock);
+    shutdown = true;
+  }
+  jobStart.notify_all();
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  delete[] ranges;
+}
+
+void ParallelEvaluator::run(ScalarFn fn, const int *in, int *out, size_t n) {
+  dispatch(fn, NULL, in, out, n);
+}
+
+void ParallelEvaluator::run(BatchFn fn, const int *in, int *out, size_t n) {
+  dispatch(NULL, fn, in, out, n);
+}
+
+void ParallelEvaluator::dispatch(
+    ScalarFn scalar, BatchFn batch, const int *in, int *out, size_t n) {
+  if (n == 0) {
+    return;
+  }
+  scalarFn = scalar;
+  batchFn = batch;
+  input = in;
+  output = out;
+  numElems = n;
+  // The first chunk absorbs the elements before the first cache line
+  // boundary of out, so no two chunks write to the same line.
+  headElems = ((CACHE_LINE - (uintptr_t)out % CACHE_LINE) % CACHE_LINE) / sizeof(int);
+  headElems = std::min(headElems, n);
+  numChunks = 1 + (n - headElems + CHUNK_ELEMS - 1) / CHUNK_ELEMS;
+
+  // Hand every worker an equal contiguous share of the chunks.
+  for (unsigned i = 0; i < numThreads; ++i) {
+    std::lock_guard<std::mutex> guard(ranges[i].lock);
+    ranges[i].begin = numChunks * i / numThreads;
+    ranges[i].end = numChunks * (i + 1) / numThreads;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(jobLock);
+    busyWorkers = numThreads - 1;
+    generation++;
+  }
+  jobStart.notify_all();
+  work(0);
+  std::unique_lock<std::mutex> guard(jobLock);
+  while (busyWorkers > 0) {
+    jobDone.wait(guard);
+  }
+}
+
+void ParallelEvaluator::workerLoop(unsigned self) {
+  unsigned seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(jobLock);
+      while (!shutdown && generation == seen) {
+        jobStart.wait(guard);
+      }
+      if (shutdown) {
+        return;
+      }
+      seen = generation;
+    }
+    work(self);
+    std::lock_guard<std::mutex> guard(jobLock);
+    if (--busyWorkers == 0) {
+      jobDone.notify_one();
+    }
+  }
+}
+
+void ParallelEvaluator::work(unsigned self) {
+  size_t chunk;
+  while (takeChunk(self, chunk)) {
+    evalChunk(chunk);
+  }
+}
+
+bool ParallelEvaluator::takeChunk(unsigned self, size_t &chunk) {
+  {
+    Range &own = ranges[self];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (own.begin < own.end) {
+      chunk = own.begin++;
+      return true;
+    }
+  }
+  // Own range exhausted: steal the back half of the largest remaining one.
+  while (true) {
+    unsigned victim = self;
+    size_t most = 0;
+    for (unsigned i = 0; i < numThreads; ++i) {
+      if (i == self) {
+        continue;
+      }
+      std::lock_guard<std::mutex> guard(ranges[i].lock);
+      size_t left = ranges[i].end - ranges[i].begin;
+      if (left > most) {
+        most = left;
+        victim = i;
+      }
+    }
+    if (victim == self) {
+      return false;
+    }
+    size_t begin, end;
+    {
+      std::lock_guard<std::mutex> guard(ranges[victim].lock);
+      Range &other = ranges[victim];
+      if (other.begin >= other.end) {
+        continue;
+      }
+      size_t take = (other.end - other.begin + 1) / 2;
+      end = other.end;
+      begin = end - take;
+      other.end = begin;
+    }
+    chunk = begin;
+    if (begin + 1 < end) {
+      Range &own = ranges[self];
+      std::lock_guard<std::mutex> guard(own.lock);
+      own.begin = begin + 1;
+      own.end = end;
+    }
+    return true;
+  }
+}
+
+void ParallelEvaluator::evalChunk(size_t chunk) {
+  size_t begin = chunk == 0 ? 0 : headElems + (chunk - 1) * CHUNK_ELEMS;
+  size_t end = std::min(numElems, headElems + chunk * CHUNK_ELEMS);
+  if (begin >= end) {
+    return;
+  }
+  if (batchFn) {
+    batchFn(input + begin, output + begin, (int)(end - begin));
+  } else {
+    for (size_t i = begin; i < end; ++i) {
+      output[i] = scalarFn(input[i]);
+    }
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef PARALLEL_EVAL_H
+#define PARALLEL_EVAL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef int (*ScalarFn)(int);
+typedef void (*BatchFn)(const int *in, int *out, int n);
+
+// Evaluates a compiled expression over a large array of x values on a pool
+// of threads. The array is split into cache-sized chunks whose boundaries
+// fall on cache lines of the output, each worker owns a contiguous range of
+// chunks and idle workers steal half of the remaining range of a busy one.
+class ParallelEvaluator {
+  public:
+    // Uses numThreads workers, the calling thread included.
+    explicit ParallelEvaluator(unsigned numThreads);
+    ~ParallelEvaluator();
+
+    // out[i] = fn(in[i]) for i < n; out may be the same array as in.
+    void run(ScalarFn fn, const int *in, int *out, size_t n);
+    void run(BatchFn fn, const int *in, int *out, size_t n);
+
+    unsigned getNumThreads() const { return numThreads; }
+
+    static const size_t CHUNK_ELEMS = 16384;
+    static const size_t CACHE_LINE = 64;
+
+  private:
+    // Chunks [begin, end) still to be evaluated by one worker.
+    struct Range {
+      std::mutex lock;
+      size_t begin;
+      size_t end;
+      char pad[CACHE_LINE];
+    };
+
+    void dispatch(ScalarFn scalar, BatchFn batch, const int *in, int *out, size_t n);
+    void work(unsigned self);
+    bool takeChunk(unsigned self, size_t &chunk);
+    void evalChunk(size_t chunk);
+    void workerLoop(unsigned self);
+
+    const unsigned numThreads;
+    std::vector<std::thread> threads;
+    Range *ranges;
+
+    // Current job.
+    ScalarFn scalarFn;
+    BatchFn batchFn;
+    const int *input;
+    int *output;
+    size_t numElems;
+    size_t headElems;
+    size_t numChunks;
+
+    std::mutex jobLock;
+    std::condition_variable jobStart;
+    std::condition_variable jobDone;
+    unsigned generation;
+    unsigned busyWorkers;
+    bool shutdown;
+};
+
+#endif
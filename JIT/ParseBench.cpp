@@ -0,0 +1,80 @@
+// Parse throughput across expression shapes and depths:
+//   chain    + 1 + 1 ... + 1 x        depth == number of operators
+//   balanced + T T with T of depth d-1, 2^d leaves
+#include <sys/time.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Expr.h"
+#include "Lexer.h"
+#include "Parser.h"
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static std::string chain(unsigned depth) {
+  std::string src;
+  src.reserve(depth * 4 + 2);
+  for (unsigned i = 0; i < depth; ++i) {
+    src += (i & 1) ? "* 3 " : "+ 1 ";
+  }
+  src += "x";
+  return src;
+}
+
+static std::string balanced(unsigned depth) {
+  std::string src = "x";
+  for (unsigned i = 0; i < depth; ++i) {
+    src = ((i & 1) ? "* " : "+ ") + src + " " + src;
+  }
+  return src;
+}
+
+static void bench(const char *shape, unsigned depth, const std::string &src) {
+  unsigned long nodes = 0;
+  unsigned runs = 0;
+  double start = now(), elapsed;
+  do {
+    Lexer lexer(src.data(), src.data() + src.size());
+    Parser parser(&lexer);
+    Expr *expr = parser.parseExpr();
+    if (!expr) {
+      fprintf(stderr, "%s depth %u: parse error\n", shape, depth);
+      return;
+    }
+    if (runs == 0) {
+      std::vector<const Expr*> worklist(1, expr);
+      while (!worklist.empty()) {
+        const Expr *e = worklist.back();
+        worklist.pop_back();
+        nodes++;
+        if (e->getOp1()) { worklist.push_back(e->getOp1()); }
+        if (e->getOp2()) { worklist.push_back(e->getOp2()); }
+      }
+    }
+    deleteExpr(expr);
+    runs++;
+    elapsed = now() - start;
+  } while (elapsed < 0.25);
+  double perParse = elapsed / runs;
+  printf("%-9s %8u %10lu %10.3f %10.1f %8.1f\n", shape, depth, nodes,
+         perParse * 1e3, nodes / perParse / 1e6, src.size() / perParse / 1e6);
+}
+
+int main() {
+  printf("%-9s %8s %10s %10s %10s %8s\n",
+         "shape", "depth", "nodes", "ms/parse", "Mnodes/s", "MB/s");
+  const unsigned chainDepths[] = { 10, 1000, 100000, 1000000 };
+  for (unsigned i = 0; i < sizeof(chainDepths) / sizeof(chainDepths[0]); ++i) {
+    bench("chain", chainDepths[i], chain(chainDepths[i]));
+  }
+  const unsigned balancedDepths[] = { 4, 10, 16, 20 };
+  for (unsigned i = 0; i < sizeof(balancedDepths) / sizeof(balancedDepths[0]); ++i) {
+    bench("balanced", balancedDepths[i], balanced(balancedDepths[i]));
+  }
+  return 0;
+}
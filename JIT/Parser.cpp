@@ -1,24 +1,68 @@
+#include <vector>
+
 #include "Expr.h"
 #include "Lexer.h"
 #include "Parser.h"
 
+namespace {
+  // An operator whose operands are still being parsed.
+  struct PendingOp {
+    Lexer::TokenKind kind;
+    Expr *op1;
+  };
+}
+
+// Prefix expressions are parsed with an explicit stack of pending operators
+// instead of recursion, so nesting depth is bounded by memory, not by the
+// call stack.
 Expr* Parser::parseExpr() {
-  std::string tk = lexer->getToken();
-  if (tk == "") {
-    return NULL;
-  } else if (isdigit(tk[0])) {
-    return new NumExpr(atoi(tk.c_str()));
-  } else if (tk[0] == 'x') {
-    return new VarExpr();
-  } else if (tk[0] == '+') {
-    Expr *op1 = parseExpr();
-    Expr *op2 = parseExpr();
-    return new AddExpr(op1, op2);
-  } else if (tk[0] == '*') {
-    Expr *op1 = parseExpr();
-    Expr *op2 = parseExpr();
-    return new MulExpr(op1, op2);
-  } else {
+  std::vector<PendingOp> pending;
+  while (true) {
+    Lexer::Token tk = lexer->getToken();
+    Expr *expr;
+    if (tk.kind == Lexer::TK_NUM) {
+      expr = new NumExpr(tk.num);
+    } else if (tk.kind == Lexer::TK_VAR) {
+      expr = new VarExpr();
+    } else if (tk.kind == Lexer::TK_ADD || tk.kind == Lexer::TK_MUL) {
+      PendingOp op = { tk.kind, NULL };
+      pending.push_back(op);
+      continue;
+    } else {
+      for (size_t i = 0; i < pending.size(); ++i) {
+        deleteExpr(pending[i].op1);
+      }
+      return NULL;
+    }
+    // Feed the finished operand to the innermost pending operator, and
+    // close every operator that now has both operands.
+    while (!pending.empty()) {
+      PendingOp &top = pending.back();
+      if (!top.op1) {
+        top.op1 = expr;
+        expr = NULL;
+        break;
+      }
+      if (top.kind == Lexer::TK_ADD) {
+        expr = new AddExpr(top.op1, expr);
+      } else {
+        expr = new MulExpr(top.op1, expr);
+      }
+      pending.pop_back();
+    }
+    if (expr) {
+      return expr;
+    }
+  }
+}
+
+Expr *parseWholeExpr(const std::string &source) {
+  Lexer lexer(source.data(), source.data() + source.size());
+  Parser parser(&lexer);
+  Expr *expr = parser.parseExpr();
+  if (expr && lexer.getToken().kind != Lexer::TK_EOF) {
+    deleteExpr(expr);
     return NULL;
   }
+  return expr;
 }
@@ -14,4 +14,8 @@ class Parser {
     Lexer* lexer;
 };
 
+// Parses source as exactly one expression, NULL if it is invalid or
+// anything is left over.
+Expr *parseWholeExpr(const std::string &source);
+
 #endif
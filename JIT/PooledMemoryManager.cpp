@@ -0,0 +1,211 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Support/Process.h"
+
+#include "PooledMemoryManager.h"
+
+SlabPool::SlabPool() : codeSlab(NULL), dataSlab(NULL), numCodeSlabs(0) {
+  pageSize = llvm::sys::Process::GetPageSize();
+}
+
+SlabPool::~SlabPool() {
+  for (size_t i = 0; i < slabs.size(); ++i) {
+    unmap(slabs[i]);
+    delete slabs[i];
+  }
+}
+
+SlabPool::Slab *SlabPool::newSlab(size_t size, bool code) {
+  Slab *slab = new Slab();
+  slab->exec = NULL;
+  slab->used = 0;
+  slab->live = 0;
+  if (!code) {
+    llvm::error_code ec;
+    slab->block = llvm::sys::Memory::allocateMappedMemory(
+      size, NULL, llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_WRITE, ec);
+    if (ec) {
+      delete slab;
+      return NULL;
+    }
+    slabs.push_back(slab);
+    return slab;
+  }
+
+  // The name only lives until both views are mapped.
+  size = (size + pageSize - 1) & ~(pageSize - 1);
+  char name[64];
+  snprintf(name, sizeof(name), "/jit-slab-%d-%u", (int)getpid(), numCodeSlabs++);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    delete slab;
+    return NULL;
+  }
+  shm_unlink(name);
+  void *rw = MAP_FAILED, *rx = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    rw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    rx = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (rw == MAP_FAILED || rx == MAP_FAILED) {
+    if (rw != MAP_FAILED) {
+      munmap(rw, size);
+    }
+    if (rx != MAP_FAILED) {
+      munmap(rx, size);
+    }
+    delete slab;
+    return NULL;
+  }
+  slab->block = llvm::sys::MemoryBlock(rw, size);
+  slab->exec = (uint8_t*)rx;
+  slabs.push_back(slab);
+  return slab;
+}
+
+void SlabPool::unmap(Slab *slab) {
+  if (slab->exec) {
+    munmap(slab->block.base(), slab->block.size());
+    munmap(slab->exec, slab->block.size());
+  } else {
+    llvm::sys::Memory::releaseMappedMemory(slab->block);
+  }
+}
+
+uint8_t *SlabPool::allocate(size_t size, unsigned alignment, bool code, Slab *&slab) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (alignment == 0) {
+    alignment = 16;
+  }
+  Slab *&current = code ? codeSlab : dataSlab;
+  uintptr_t addr = 0;
+  if (current) {
+    uintptr_t base = (uintptr_t)current->block.base();
+    addr = (base + current->used + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (addr + size > base + current->block.size()) {
+      addr = 0;
+    }
+  }
+  if (!addr) {
+    // Oversized sections get a slab of their own.
+    size_t slabSize = std::max((size_t)SLAB_SIZE, size + alignment);
+    Slab *fresh = newSlab(slabSize, code);
+    if (!fresh) {
+      return NULL;
+    }
+    if (slabSize == SLAB_SIZE) {
+      current = fresh;
+    }
+    uintptr_t base = (uintptr_t)fresh->block.base();
+    addr = (base + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    slab = fresh;
+  } else {
+    slab = current;
+  }
+  slab->used = addr + size - (uintptr_t)slab->block.base();
+  slab->live += size;
+  return (uint8_t*)addr;
+}
+
+void SlabPool::release(Slab *slab, size_t size) {
+  std::lock_guard<std::mutex> guard(lock);
+  slab->live -= size;
+  if (slab->live > 0) {
+    return;
+  }
+  if (slab == codeSlab || slab == dataSlab) {
+    // Keep the slab we are filling, just start over.
+    slab->used = 0;
+    return;
+  }
+  unmap(slab);
+  slabs.erase(std::find(slabs.begin(), slabs.end(), slab));
+  delete slab;
+}
+
+size_t SlabPool::getMappedBytes() const {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t bytes = 0;
+  for (size_t i = 0; i < slabs.size(); ++i) {
+    bytes += slabs[i]->block.size();
+  }
+  return bytes;
+}
+
+size_t SlabPool::getLiveBytes() const {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t bytes = 0;
+  for (size_t i = 0; i < slabs.size(); ++i) {
+    bytes += slabs[i]->live;
+  }
+  return bytes;
+}
+
+unsigned SlabPool::getNumSlabs() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return slabs.size();
+}
+
+PooledMemoryManager::~PooledMemoryManager() {
+  for (size_t i = 0; i < allocations.size(); ++i) {
+    pool.release(allocations[i].slab, allocations[i].size);
+  }
+}
+
+uint8_t *PooledMemoryManager::allocateCodeSection(
+    uintptr_t Size, unsigned Alignment, unsigned SectionID,
+    llvm::StringRef SectionName) {
+  Allocation a;
+  a.size = Size;
+  a.addr = pool.allocate(Size, Alignment, true, a.slab);
+  if (!a.addr) {
+    return NULL;
+  }
+  allocations.push_back(a);
+  unmappedCode.push_back(a);
+  allocatedBytes += Size;
+  return a.addr;
+}
+
+uint8_t *PooledMemoryManager::allocateDataSection(
+    uintptr_t Size, unsigned Alignment, unsigned SectionID,
+    llvm::StringRef SectionName, bool IsReadOnly) {
+  Allocation a;
+  a.size = Size;
+  a.addr = pool.allocate(Size, Alignment, false, a.slab);
+  if (!a.addr) {
+    return NULL;
+  }
+  allocations.push_back(a);
+  allocatedBytes += Size;
+  return a.addr;
+}
+
+void PooledMemoryManager::notifyObjectLoaded(llvm::ExecutionEngine *EE,
+                                             const llvm::ObjectImage *) {
+  // Called before relocation, so the code is linked for where it runs.
+  for (size_t i = 0; i < unmappedCode.size(); ++i) {
+    Allocation &a = unmappedCode[i];
+    EE->mapSectionAddress(a.addr, (uint64_t)(uintptr_t)SlabPool::execAddress(a.slab, a.addr));
+    unsealedCode.push_back(a);
+  }
+  unmappedCode.clear();
+}
+
+bool PooledMemoryManager::finalizeMemory(std::string *ErrMsg) {
+  // The read-execute view never changes protection; it only needs the
+  // icache to see what was written through the other view.
+  for (size_t i = 0; i < unsealedCode.size(); ++i) {
+    Allocation &a = unsealedCode[i];
+    llvm::sys::Memory::InvalidateInstructionCache(SlabPool::execAddress(a.slab, a.addr), a.size);
+  }
+  unsealedCode.clear();
+  return false;
+}
@@ -0,0 +1,93 @@
+#ifndef POOLED_MEMORY_MANAGER_H
+#define POOLED_MEMORY_MANAGER_H
+
+#include <mutex>
+#include <vector>
+
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/Support/Memory.h"
+
+// Slabs of mapped memory shared by many small JIT'd modules. Code and data
+// are bump-allocated from separate slabs; a slab is unmapped once every
+// allocation in it has been released.
+//
+// Code slabs are mapped twice from one shared memory object: code is
+// written through a read-write view and runs from a read-execute view at
+// another address, so no page is ever writable and executable at once and
+// code of many modules is packed on the same pages. Modules can be emitted
+// while code from the pool runs on other threads.
+class SlabPool {
+  public:
+    static const size_t SLAB_SIZE = 256 * 1024;
+
+    struct Slab {
+      // Read-write view; the only view of data slabs.
+      llvm::sys::MemoryBlock block;
+      // Read-execute view of code slabs, NULL for data.
+      uint8_t *exec;
+      size_t used;
+      size_t live;
+    };
+
+    SlabPool();
+    ~SlabPool();
+
+    // Writable address of the allocation; code runs from execAddress.
+    uint8_t *allocate(size_t size, unsigned alignment, bool code, Slab *&slab);
+    void release(Slab *slab, size_t size);
+    static uint8_t *execAddress(const Slab *slab, uint8_t *addr) {
+      return slab->exec + (addr - (uint8_t*)slab->block.base());
+    }
+
+    size_t getMappedBytes() const;
+    size_t getLiveBytes() const;
+    unsigned getNumSlabs() const;
+
+  private:
+    Slab *newSlab(size_t size, bool code);
+    void unmap(Slab *slab);
+
+    mutable std::mutex lock;
+    std::vector<Slab*> slabs;
+    Slab *codeSlab;
+    Slab *dataSlab;
+    size_t pageSize;
+    unsigned numCodeSlabs;
+};
+
+// Per-engine MCJIT memory manager allocating from a shared SlabPool. The
+// engine owns it; deleting the engine hands its memory back to the pool.
+class PooledMemoryManager : public llvm::RTDyldMemoryManager {
+  public:
+    explicit PooledMemoryManager(SlabPool &pool) : pool(pool), allocatedBytes(0) {}
+    virtual ~PooledMemoryManager();
+
+    virtual uint8_t *allocateCodeSection(
+      uintptr_t Size, unsigned Alignment, unsigned SectionID,
+      llvm::StringRef SectionName);
+    virtual uint8_t *allocateDataSection(
+      uintptr_t Size, unsigned Alignment, unsigned SectionID,
+      llvm::StringRef SectionName, bool IsReadOnly);
+    // Points the relocations of new code at its read-execute view.
+    virtual void notifyObjectLoaded(llvm::ExecutionEngine *EE, const llvm::ObjectImage *);
+    virtual bool finalizeMemory(std::string *ErrMsg = 0);
+
+    // Bytes of code and data this module occupies in the pool.
+    size_t getAllocatedBytes() const { return allocatedBytes; }
+
+  private:
+    struct Allocation {
+      SlabPool::Slab *slab;
+      uint8_t *addr;
+      size_t size;
+    };
+
+    SlabPool &pool;
+    std::vector<Allocation> allocations;
+    // Code not yet remapped, and remapped but not yet finalized.
+    std::vector<Allocation> unmappedCode;
+    std::vector<Allocation> unsealedCode;
+    size_t allocatedBytes;
+};
+
+#endif
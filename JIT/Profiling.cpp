@@ -0,0 +1,269 @@
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#ifdef __linux__
+#include <elf.h>
+#include <sys/syscall.h>
+#endif
+
+#include "llvm/ExecutionEngine/ObjectImage.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Profiling.h"
+
+namespace {
+  // jitdump format, see tools/perf/Documentation/jitdump-specification.txt
+  struct JitDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t totalSize;
+    uint32_t elfMach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+  };
+
+  struct JitDumpCodeLoad {
+    uint32_t id;
+    uint32_t totalSize;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t codeAddr;
+    uint64_t codeSize;
+    uint64_t codeIndex;
+  };
+
+  const uint32_t JITDUMP_MAGIC = 0x4A695444;
+  const uint32_t JIT_CODE_LOAD = 0;
+
+  // perf matches jitdump records to samples on CLOCK_MONOTONIC (perf -k 1).
+  uint64_t monotonicNanos() {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+    return 0;
+#endif
+  }
+
+  uint32_t threadId() {
+#ifdef __linux__
+    return syscall(SYS_gettid);
+#else
+    return getpid();
+#endif
+  }
+
+  // text on one line, whitespace runs collapsed to a single space and
+  // trimmed, cut at max characters: perf maps hold one symbol per line.
+  std::string oneLine(const std::string &text, size_t max) {
+    std::string line;
+    for (size_t i = 0; i < text.size() && line.size() < max; ++i) {
+      if (!isspace((unsigned char)text[i])) {
+        line += text[i];
+      } else if (!line.empty() && line[line.size() - 1] != ' ') {
+        line += ' ';
+      }
+    }
+    if (!line.empty() && line[line.size() - 1] == ' ') {
+      line.erase(line.size() - 1);
+    }
+    return line;
+  }
+
+  const size_t MAX_LABEL = 96;
+}
+
+JITProfiler::JITProfiler(unsigned outputs)
+  : perfMap(NULL), jitDump(NULL), jitDumpMarker(NULL), codeIndex(0) {
+  char path[64];
+  if (outputs & PERF_MAP) {
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    perfMap = fopen(path, "w");
+  }
+  if (outputs & JITDUMP) {
+    snprintf(path, sizeof(path), "jit-%d.dump", (int)getpid());
+    jitDump = fopen(path, "w+");
+    if (jitDump) {
+      writeJitDumpHeader();
+    }
+  }
+}
+
+JITProfiler::~JITProfiler() {
+  if (perfMap) {
+    fclose(perfMap);
+  }
+  if (jitDumpMarker) {
+    munmap(jitDumpMarker, sysconf(_SC_PAGESIZE));
+  }
+  if (jitDump) {
+    fclose(jitDump);
+  }
+  for (size_t i = 0; i < counters.size(); ++i) {
+    delete counters[i];
+  }
+}
+
+void JITProfiler::writeJitDumpHeader() {
+  JitDumpHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = JITDUMP_MAGIC;
+  header.version = 1;
+  header.totalSize = sizeof(header);
+#if defined(__linux__) && defined(__x86_64__)
+  header.elfMach = EM_X86_64;
+#elif defined(__linux__) && defined(__aarch64__)
+  header.elfMach = EM_AARCH64;
+#endif
+  header.pid = getpid();
+  header.timestamp = monotonicNanos();
+  fwrite(&header, sizeof(header), 1, jitDump);
+  fflush(jitDump);
+  // perf only picks up the dump file if the process mapped it executable.
+  void *marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE, fileno(jitDump), 0);
+  jitDumpMarker = marker == MAP_FAILED ? NULL : marker;
+}
+
+void JITProfiler::setLabel(const llvm::Function *F, const std::string &label) {
+  std::string line = oneLine(label, MAX_LABEL + 1);
+  if (line.size() > MAX_LABEL) {
+    line = line.substr(0, MAX_LABEL - 3) + "...";
+  }
+  labels[F] = line;
+}
+
+std::string JITProfiler::labelFor(const llvm::Function &F) const {
+  std::map<const llvm::Function*, std::string>::const_iterator it = labels.find(&F);
+  if (it != labels.end()) {
+    return F.getName().str() + " [" + it->second + "]";
+  }
+  return F.getName().str();
+}
+
+void JITProfiler::instrument(llvm::Function *F) {
+  llvm::LLVMContext &context = F->getContext();
+  llvm::Type *int64Ty = llvm::Type::getInt64Ty(context);
+  llvm::Type *int64PtrTy = llvm::Type::getInt64PtrTy(context);
+  Counters *c = new Counters();
+  c->label = labelFor(*F);
+  c->calls = 0;
+  c->cycles = 0;
+  counters.push_back(c);
+
+  // The counters live in this process, so the JIT'd code addresses them
+  // directly.
+  llvm::Constant *calls = llvm::ConstantExpr::getIntToPtr(
+    llvm::ConstantInt::get(int64Ty, (uint64_t)(uintptr_t)&c->calls), int64PtrTy);
+  llvm::Constant *cycles = llvm::ConstantExpr::getIntToPtr(
+    llvm::ConstantInt::get(int64Ty, (uint64_t)(uintptr_t)&c->cycles), int64PtrTy);
+  llvm::Function *readCycles = llvm::Intrinsic::getDeclaration(
+    F->getParent(), llvm::Intrinsic::readcyclecounter);
+
+  llvm::BasicBlock &entry = F->getEntryBlock();
+  llvm::IRBuilder<> builder(&entry, entry.getFirstInsertionPt());
+  llvm::Value *start = builder.CreateCall(readCycles, "start");
+  builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, calls,
+                          llvm::ConstantInt::get(int64Ty, 1), llvm::Monotonic);
+
+  std::vector<llvm::ReturnInst*> returns;
+  for (llvm::Function::iterator bb = F->begin(), e = F->end(); bb != e; ++bb) {
+    if (llvm::ReturnInst *ret = llvm::dyn_cast<llvm::ReturnInst>(bb->getTerminator())) {
+      returns.push_back(ret);
+    }
+  }
+  for (size_t i = 0; i < returns.size(); ++i) {
+    builder.SetInsertPoint(returns[i]);
+    llvm::Value *end = builder.CreateCall(readCycles, "end");
+    builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, cycles,
+                            builder.CreateSub(end, start, "elapsed"), llvm::Monotonic);
+  }
+}
+
+void JITProfiler::report(llvm::raw_ostream &os) const {
+  std::vector<const Counters*> sorted(counters.begin(), counters.end());
+  std::sort(sorted.begin(), sorted.end(), [](const Counters *a, const Counters *b) {
+    return a->cycles > b->cycles;
+  });
+  os << llvm::format("%12s %16s %12s  %s\n", "calls", "cycles", "cycles/call", "function");
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    const Counters *c = sorted[i];
+    os << llvm::format("%12llu %16llu %12.1f  ",
+                       (unsigned long long)c->calls, (unsigned long long)c->cycles,
+                       c->calls ? (double)c->cycles / c->calls : 0.0)
+       << c->label << "\n";
+  }
+}
+
+void JITProfiler::emitted(const std::string &symbol, const void *code, uint64_t size) {
+  // Labels are clean already; names from object files may not be.
+  std::string name = oneLine(symbol, symbol.size());
+  if (perfMap) {
+    fprintf(perfMap, "%llx %llx %s\n", (unsigned long long)(uintptr_t)code,
+            (unsigned long long)size, name.c_str());
+    fflush(perfMap);
+  }
+  if (jitDump) {
+    JitDumpCodeLoad record;
+    record.id = JIT_CODE_LOAD;
+    record.totalSize = sizeof(record) + name.size() + 1 + size;
+    record.timestamp = monotonicNanos();
+    record.pid = getpid();
+    record.tid = threadId();
+    record.vma = (uint64_t)(uintptr_t)code;
+    record.codeAddr = record.vma;
+    record.codeSize = size;
+    record.codeIndex = codeIndex++;
+    fwrite(&record, sizeof(record), 1, jitDump);
+    fwrite(name.c_str(), name.size() + 1, 1, jitDump);
+    fwrite(code, size, 1, jitDump);
+    fflush(jitDump);
+  }
+}
+
+void JITProfiler::NotifyFunctionEmitted(
+    const llvm::Function &F, void *Code, size_t Size,
+    const EmittedFunctionDetails &Details) {
+  emitted(labelFor(F), Code, Size);
+}
+
+void JITProfiler::NotifyObjectEmitted(const llvm::ObjectImage &Obj) {
+  // MCJIT: the loaded image carries the final symbol addresses.
+  llvm::error_code ec;
+  for (llvm::object::symbol_iterator i = Obj.begin_symbols(), e = Obj.end_symbols();
+       i != e; i.increment(ec)) {
+    if (ec) {
+      break;
+    }
+    llvm::object::SymbolRef::Type type;
+    llvm::StringRef name;
+    uint64_t addr, size;
+    if (i->getType(type) || type != llvm::object::SymbolRef::ST_Function ||
+        i->getName(name) || i->getAddress(addr) || i->getSize(size)) {
+      continue;
+    }
+    std::string label = name.str();
+    for (std::map<const llvm::Function*, std::string>::const_iterator l = labels.begin();
+         l != labels.end(); ++l) {
+      if (l->first->getName() == name) {
+        label = labelFor(*l->first);
+        break;
+      }
+    }
+    emitted(label, (const void*)(uintptr_t)addr, size);
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef PROFILING_H
+#define PROFILING_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/JITEventListener.h"
+
+namespace llvm {
+  class raw_ostream;
+}
+
+// Makes JIT'd expressions visible to profilers. Registered on an engine,
+// it describes every emitted function in /tmp/perf-<pid>.map and/or a
+// jit-<pid>.dump file for `perf inject --jit`. Functions can also be
+// instrumented to count their calls and cycles for report().
+class JITProfiler : public llvm::JITEventListener {
+  public:
+    enum Output {
+      PERF_MAP = 1,
+      JITDUMP = 2
+    };
+
+    explicit JITProfiler(unsigned outputs);
+    ~JITProfiler();
+
+    // Name F is reported under, e.g. the expression it computes. It is
+    // put on one line and cut to a bounded length.
+    void setLabel(const llvm::Function *F, const std::string &label);
+
+    // Counts calls and cycles of F; call before F is compiled.
+    void instrument(llvm::Function *F);
+
+    // Calls, cycles and cycles per call of every instrumented function,
+    // hottest first.
+    void report(llvm::raw_ostream &os) const;
+
+    virtual void NotifyFunctionEmitted(
+      const llvm::Function &F, void *Code, size_t Size,
+      const EmittedFunctionDetails &Details);
+    virtual void NotifyObjectEmitted(const llvm::ObjectImage &Obj);
+
+  private:
+    struct Counters {
+      std::string label;
+      uint64_t calls;
+      uint64_t cycles;
+    };
+
+    std::string labelFor(const llvm::Function &F) const;
+    void emitted(const std::string &name, const void *code, uint64_t size);
+    void writeJitDumpHeader();
+
+    FILE *perfMap;
+    FILE *jitDump;
+    void *jitDumpMarker;
+    uint64_t codeIndex;
+    std::map<const llvm::Function*, std::string> labels;
+    std::vector<Counters*> counters;
+};
+
+#endif
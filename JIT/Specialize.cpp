@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <string>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+
+#include "Expr.h"
+#include "Specialize.h"
+
+const double Specialization::HOT_SHARE = 0.05;
+const double Specialization::RANGE_SHARE = 0.5;
+
+ValueProfile::ValueProfile(unsigned sampleRate, size_t maxSamples)
+  : sampleRate(sampleRate ? sampleRate : 1), maxSamples(maxSamples), calls(0) {}
+
+Specialization planSpecialization(const ValueProfile &profile) {
+  Specialization spec;
+  std::vector<int> sorted(profile.getSamples());
+  if (sorted.empty()) {
+    return spec;
+  }
+  std::sort(sorted.begin(), sorted.end());
+  const double total = sorted.size();
+
+  // Window of at most MAX_RANGE_SPAN values holding the most samples; the
+  // samples are sorted, so both of its ends only move forward.
+  size_t bestBegin = 0, bestEnd = 0;
+  for (size_t begin = 0, end = 0; begin < sorted.size(); ++begin) {
+    while (end < sorted.size() &&
+           (long long)sorted[end] - sorted[begin] < Specialization::MAX_RANGE_SPAN) {
+      ++end;
+    }
+    if (end - begin > bestEnd - bestBegin) {
+      bestBegin = begin;
+      bestEnd = end;
+    }
+  }
+  size_t covered = 0;
+  if ((bestEnd - bestBegin) / total >= Specialization::RANGE_SHARE) {
+    spec.hasRange = true;
+    spec.rangeLo = sorted[bestBegin];
+    spec.rangeSpan = (unsigned)((long long)sorted[bestEnd - 1] - sorted[bestBegin] + 1);
+    covered = bestEnd - bestBegin;
+  }
+
+  // Runs of equal values outside the table are hot value candidates.
+  std::vector<std::pair<size_t, int> > runs;
+  for (size_t i = 0; i < sorted.size();) {
+    size_t j = i;
+    while (j < sorted.size() && sorted[j] == sorted[i]) {
+      ++j;
+    }
+    bool inRange = spec.hasRange && i >= bestBegin && i < bestEnd;
+    if (!inRange && (j - i) / total >= Specialization::HOT_SHARE) {
+      runs.push_back(std::make_pair(j - i, sorted[i]));
+    }
+    i = j;
+  }
+  std::sort(runs.rbegin(), runs.rend());
+  for (size_t i = 0; i < runs.size() && i < Specialization::MAX_HOT_VALUES; ++i) {
+    spec.hotValues.push_back(std::make_pair(runs[i].second, runs[i].first / total));
+    covered += runs[i].first;
+  }
+  spec.coverage = covered / total;
+  return spec;
+}
+
+static int evalAt(const Expr *expr, int x) {
+  VarExpr::varInt = x;
+  return expr->eval();
+}
+
+llvm::Function *genSpecializedFunction(
+    llvm::Module *module,
+    llvm::LLVMContext &context,
+    const Expr *expr,
+    const Specialization &spec,
+    const char *name) {
+  llvm::IntegerType *intTy = llvm::Type::getInt32Ty(context);
+  llvm::Function *function =
+     llvm::cast<llvm::Function>(
+         module->getOrInsertFunction(name, intTy, intTy, (llvm::Type *)0));
+  llvm::Argument *argX = function->arg_begin();
+  argX->setName("x");
+  llvm::IRBuilder<> builder(context);
+
+  llvm::BasicBlock *entry = llvm::BasicBlock::Create(context, "entry", function);
+  llvm::BasicBlock *hot = llvm::BasicBlock::Create(context, "hot", function);
+  llvm::BasicBlock *generic = llvm::BasicBlock::Create(context, "generic", function);
+
+  // (unsigned)(x - lo) < span: one compare for both ends of the range.
+  builder.SetInsertPoint(entry);
+  if (spec.hasRange) {
+    std::vector<uint32_t> values(spec.rangeSpan);
+    for (unsigned i = 0; i < spec.rangeSpan; ++i) {
+      values[i] = evalAt(expr, (int)((unsigned)spec.rangeLo + i));
+    }
+    llvm::Constant *init =
+      llvm::ConstantDataArray::get(context, llvm::ArrayRef<uint32_t>(values));
+    llvm::GlobalVariable *table =
+      new llvm::GlobalVariable(*module, init->getType(), true,
+                               llvm::GlobalValue::PrivateLinkage, init,
+                               std::string(name) + ".table");
+
+    llvm::BasicBlock *lookup = llvm::BasicBlock::Create(context, "lookup", function, hot);
+    llvm::Value *index = builder.CreateSub(argX, llvm::ConstantInt::get(intTy, spec.rangeLo), "index");
+    builder.CreateCondBr(
+      builder.CreateICmpULT(index, llvm::ConstantInt::get(intTy, spec.rangeSpan), "inrange"),
+      lookup, hot);
+
+    builder.SetInsertPoint(lookup);
+    llvm::Value *indices[] = {
+      llvm::ConstantInt::get(intTy, 0),
+      builder.CreateZExt(index, llvm::Type::getInt64Ty(context))
+    };
+    builder.CreateRet(builder.CreateLoad(builder.CreateInBoundsGEP(table, indices)));
+  } else {
+    builder.CreateBr(hot);
+  }
+
+  builder.SetInsertPoint(hot);
+  llvm::SwitchInst *sw = builder.CreateSwitch(argX, generic, spec.hotValues.size());
+  for (size_t i = 0; i < spec.hotValues.size(); ++i) {
+    int value = spec.hotValues[i].first;
+    llvm::BasicBlock *fast = llvm::BasicBlock::Create(context, "fast", function, generic);
+    sw->addCase(llvm::ConstantInt::get(intTy, value), fast);
+    builder.SetInsertPoint(fast);
+    builder.CreateRet(llvm::ConstantInt::get(intTy, evalAt(expr, value)));
+  }
+
+  builder.SetInsertPoint(generic);
+  VarExpr::varValue = argX;
+  builder.CreateRet(expr->gen(&builder, context));
+  return function;
+}
@@ -0,0 +1,92 @@
+#ifndef SPECIALIZE_H
+#define SPECIALIZE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "llvm/IR/LLVMContext.h"
+
+#include "ParallelEval.h"
+
+namespace llvm {
+  class Function;
+  class Module;
+}
+
+class Expr;
+
+// Distribution of the x values fun is called with, from every
+// sampleRate-th call and at most maxSamples of them.
+class ValueProfile {
+  public:
+    explicit ValueProfile(unsigned sampleRate = 8, size_t maxSamples = 1 << 16);
+
+    void record(int x) {
+      if (calls++ % sampleRate == 0 && samples.size() < maxSamples) {
+        samples.push_back(x);
+      }
+    }
+
+    size_t getNumCalls() const { return calls; }
+    const std::vector<int> &getSamples() const { return samples; }
+
+  private:
+    const unsigned sampleRate;
+    const size_t maxSamples;
+    size_t calls;
+    std::vector<int> samples;
+};
+
+// Guards of a specialized fun, chosen from a profile. x in
+// [rangeLo, rangeLo + rangeSpan) is answered from a precomputed table,
+// each hot value outside it by a constant; anything else falls through to
+// the generic code.
+struct Specialization {
+  Specialization() : hasRange(false), rangeLo(0), rangeSpan(0), coverage(0) {}
+
+  bool empty() const { return !hasRange && hotValues.empty(); }
+
+  // Hot values and their share of the samples, hottest first.
+  std::vector<std::pair<int, double> > hotValues;
+  bool hasRange;
+  int rangeLo;
+  unsigned rangeSpan;
+  // Share of the samples taking a fast path.
+  double coverage;
+
+  // A value is hot from this share of the samples on.
+  static const double HOT_SHARE;
+  static const unsigned MAX_HOT_VALUES = 8;
+  // A range gets a table when it is at most this wide and holds at least
+  // RANGE_SHARE of the samples.
+  static const unsigned MAX_RANGE_SPAN = 4096;
+  static const double RANGE_SHARE;
+};
+
+Specialization planSpecialization(const ValueProfile &profile);
+
+// int fun_spec(int x), evaluating expr behind the guards of spec.
+llvm::Function *genSpecializedFunction(
+    llvm::Module *module,
+    llvm::LLVMContext &context,
+    const Expr *expr,
+    const Specialization &spec,
+    const char *name = "fun_spec");
+
+// Entry point of a compiled expression that callers on any thread go
+// through, so a specialized version can replace it while they run.
+class HotSwapFunction {
+  public:
+    explicit HotSwapFunction(ScalarFn fn) : target(fn) {}
+
+    int operator()(int x) const { return target.load(std::memory_order_acquire)(x); }
+    void swap(ScalarFn fn) { target.store(fn, std::memory_order_release); }
+    ScalarFn get() const { return target.load(std::memory_order_acquire); }
+
+  private:
+    std::atomic<ScalarFn> target;
+};
+
+#endif
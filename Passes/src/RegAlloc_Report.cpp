@@ -0,0 +1,196 @@
+#define DEBUG_TYPE "regallocReport"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineMemOperand.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetInstrInfo.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetRegisterInfo.h"
+#include <algorithm>
+#include <set>
+#include <vector>
+using namespace llvm;
+
+// Reports spills, reloads, copies and the peak number of live registers of
+// every machine basic block and machine loop. Meant to run right after the
+// virtual registers are rewritten, while spill code still refers to spill
+// slots and copies are still COPYs. cost = (spills + reloads + copies) *
+// 10^loop depth, the loop rows sum their blocks, nested loops included; it
+// is a double, as 10^depth leaves uint64_t from depth 20 on.
+// opt cannot schedule machine passes; Passes/tools/regalloc-report runs it.
+namespace {
+    struct BlockStats {
+        BlockStats() : instrs(0), spills(0), reloads(0), copies(0), pressure(0), depth(0) {}
+        unsigned instrs, spills, reloads, copies, pressure, depth;
+        double cost() const {
+            double weight = 1;
+            for (unsigned d = 0; d < depth; ++d) {
+                weight *= 10;
+            }
+            return weight * (spills + reloads + copies);
+        }
+    };
+
+    struct LoopRow {
+        unsigned header, depth, blocks, spills, reloads, copies, pressure;
+        double cost;
+        bool operator<(const LoopRow &other) const { return cost > other.cost; }
+    };
+
+    struct RegAllocReport : public MachineFunctionPass {
+        static char ID;
+        const TargetInstrInfo *TII;
+        const TargetRegisterInfo *TRI;
+        const MachineRegisterInfo *MRI;
+        const MachineFrameInfo *MFI;
+        RegAllocReport() : MachineFunctionPass(ID) {}
+
+        virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+            AU.addRequired<MachineLoopInfo>();
+            AU.setPreservesAll();
+            MachineFunctionPass::getAnalysisUsage(AU);
+        }
+
+        // Live registers are counted by their outermost super-register, so
+        // that e.g. EAX and RAX are one register.
+        unsigned topRegister(unsigned Reg) {
+            for (MCSuperRegIterator SR(Reg, TRI); SR.isValid(); ++SR) {
+                if (!MCSuperRegIterator(*SR, TRI).isValid()) {
+                    return *SR;
+                }
+            }
+            return Reg;
+        }
+
+        void addLive(std::set<unsigned> &live, unsigned Reg) {
+            if (TargetRegisterInfo::isPhysicalRegister(Reg) && MRI->isAllocatable(Reg)) {
+                live.insert(topRegister(Reg));
+            }
+        }
+
+        BlockStats countBlock(const MachineBasicBlock &MBB) {
+            BlockStats stats;
+            // Walk backwards from the registers live into the successors.
+            std::set<unsigned> live;
+            for (MachineBasicBlock::const_succ_iterator S = MBB.succ_begin(), E = MBB.succ_end();
+                 S != E; ++S) {
+                for (MachineBasicBlock::livein_iterator L = (*S)->livein_begin(),
+                     LE = (*S)->livein_end(); L != LE; ++L) {
+                    addLive(live, *L);
+                }
+            }
+            stats.pressure = live.size();
+            for (MachineBasicBlock::const_reverse_iterator I = MBB.rbegin(), E = MBB.rend();
+                 I != E; ++I) {
+                const MachineInstr *MI = &*I;
+                if (MI->isDebugValue()) {
+                    continue;
+                }
+                stats.instrs++;
+                const MachineMemOperand *MMO;
+                int FI;
+                if (TII->hasStoreToStackSlot(MI, MMO, FI) && MFI->isSpillSlotObjectIndex(FI)) {
+                    stats.spills++;
+                }
+                if (TII->hasLoadFromStackSlot(MI, MMO, FI) && MFI->isSpillSlotObjectIndex(FI)) {
+                    stats.reloads++;
+                }
+                if (MI->isCopy()) {
+                    stats.copies++;
+                }
+                for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
+                    const MachineOperand &MO = MI->getOperand(i);
+                    if (MO.isReg() && MO.isDef() && MO.getReg() &&
+                        TargetRegisterInfo::isPhysicalRegister(MO.getReg())) {
+                        live.erase(topRegister(MO.getReg()));
+                    }
+                }
+                for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
+                    const MachineOperand &MO = MI->getOperand(i);
+                    if (MO.isReg() && MO.isUse() && MO.getReg() && !MO.isUndef()) {
+                        addLive(live, MO.getReg());
+                    }
+                }
+                stats.pressure = std::max<unsigned>(stats.pressure, live.size());
+            }
+            return stats;
+        }
+
+        void addLoop(MachineLoop *L, const std::vector<BlockStats> &blocks,
+                     std::vector<LoopRow> &rows) {
+            LoopRow row = { (unsigned)L->getHeader()->getNumber(), L->getLoopDepth(),
+                            L->getNumBlocks(), 0, 0, 0, 0, 0 };
+            for (MachineLoop::block_iterator b = L->block_begin(), e = L->block_end(); b != e; ++b) {
+                const BlockStats &stats = blocks[(*b)->getNumber()];
+                row.spills += stats.spills;
+                row.reloads += stats.reloads;
+                row.copies += stats.copies;
+                row.pressure = std::max(row.pressure, stats.pressure);
+                row.cost += stats.cost();
+            }
+            rows.push_back(row);
+            for (MachineLoop::iterator i = L->begin(), e = L->end(); i != e; ++i) {
+                addLoop(*i, blocks, rows);
+            }
+        }
+
+        virtual bool runOnMachineFunction(MachineFunction &MF) {
+            TII = MF.getTarget().getInstrInfo();
+            TRI = MF.getTarget().getRegisterInfo();
+            MRI = &MF.getRegInfo();
+            MFI = MF.getFrameInfo();
+            MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+
+            std::vector<BlockStats> blocks(MF.getNumBlockIDs());
+            BlockStats total;
+            double totalCost = 0;
+            for (MachineFunction::iterator MBB = MF.begin(), E = MF.end(); MBB != E; ++MBB) {
+                BlockStats &stats = blocks[MBB->getNumber()];
+                stats = countBlock(*MBB);
+                stats.depth = MLI.getLoopDepth(&*MBB);
+                total.spills += stats.spills;
+                total.reloads += stats.reloads;
+                total.copies += stats.copies;
+                total.pressure = std::max(total.pressure, stats.pressure);
+                totalCost += stats.cost();
+            }
+
+            errs() << "Function " << MF.getName() << ": " << total.spills << " spills, "
+                   << total.reloads << " reloads, " << total.copies << " copies, max pressure "
+                   << total.pressure << ", cost " << format("%.6g", totalCost) << "\n";
+            errs() << "  block   depth  instrs  spills reloads  copies pressure       cost\n";
+            for (MachineFunction::iterator MBB = MF.begin(), E = MF.end(); MBB != E; ++MBB) {
+                const BlockStats &stats = blocks[MBB->getNumber()];
+                if (stats.spills + stats.reloads + stats.copies == 0) {
+                    continue;
+                }
+                errs() << format("  BB#%-4d %5u %7u %7u %7u %7u %8u %10.6g\n",
+                                 MBB->getNumber(), stats.depth, stats.instrs, stats.spills,
+                                 stats.reloads, stats.copies, stats.pressure, stats.cost());
+            }
+
+            std::vector<LoopRow> rows;
+            for (MachineLoopInfo::iterator i = MLI.begin(), e = MLI.end(); i != e; ++i) {
+                addLoop(*i, blocks, rows);
+            }
+            if (!rows.empty()) {
+                std::stable_sort(rows.begin(), rows.end());
+                errs() << "  loop    depth  blocks  spills reloads  copies pressure       cost\n";
+                for (unsigned i = 0; i < rows.size(); ++i) {
+                    const LoopRow &row = rows[i];
+                    errs() << format("  BB#%-4u %5u %7u %7u %7u %7u %8u %10.6g\n",
+                                     row.header, row.depth, row.blocks, row.spills,
+                                     row.reloads, row.copies, row.pressure, row.cost);
+                }
+            }
+            errs() << "\n";
+            return false;
+        }
+    };
+}
+
+char RegAllocReport::ID = 0;
+static RegisterPass<RegAllocReport> X("regallocReport", "Report spills, copies and register pressure per block and loop");
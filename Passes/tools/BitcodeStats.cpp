@@ -0,0 +1,125 @@
+//===- BitcodeStats.cpp ---------------------------------------------------===//
+//
+// Opcode, phi and loop statistics of a bitcode file without loading all of
+// it: the module is read lazily, and each function body is materialized,
+// analyzed and dropped again before the next one, so peak memory follows
+// the largest function instead of the whole module.
+//
+//   bitcode-stats [-opcodes] [-totals] [-eager] <file.bc>
+//
+// -opcodes prints the opcode counts of every function, -totals only the
+// module totals, and -eager materializes the whole module up front as opt
+// does, to compare the peak RSS.
+//
+//===----------------------------------------------------------------------===//
+
+#include "FunctionStats.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/PassManager.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include <cstring>
+#include <sys/resource.h>
+using namespace llvm;
+
+static double peakRSSMegabytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+static void usage() {
+    errs() << "usage: bitcode-stats [-opcodes] [-totals] [-eager] <file.bc>\n";
+}
+
+int main(int argc, char **argv) {
+    bool withOpcodes = false, totalsOnly = false, eager = false;
+    const char *path = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-opcodes")) {
+            withOpcodes = true;
+        } else if (!strcmp(argv[i], "-totals")) {
+            totalsOnly = true;
+        } else if (!strcmp(argv[i], "-eager")) {
+            eager = true;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (!path) {
+        usage();
+        return 1;
+    }
+
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeAnalysis(registry);
+
+    OwningPtr<MemoryBuffer> buffer;
+    if (error_code ec = MemoryBuffer::getFileOrSTDIN(path, buffer)) {
+        errs() << path << ": " << ec.message() << "\n";
+        return 1;
+    }
+    LLVMContext context;
+    std::string err;
+    // On success the module owns the buffer and reads function bodies from
+    // it on demand.
+    OwningPtr<Module> module(getLazyBitcodeModule(buffer.get(), context, &err));
+    if (!module) {
+        errs() << path << ": " << err << "\n";
+        return 1;
+    }
+    buffer.take();
+    if (eager && module->MaterializeAllPermanently(&err)) {
+        errs() << path << ": " << err << "\n";
+        return 1;
+    }
+
+    FunctionPassManager passManager(module.get());
+    CollectFunctionStats *collect = new CollectFunctionStats();
+    passManager.add(collect);
+    passManager.doInitialization();
+
+    FunctionStats totals;
+    totals.name = "total";
+    unsigned functions = 0;
+    for (Module::iterator F = module->begin(), E = module->end(); F != E; ++F) {
+        if (F->isDeclaration()) {
+            continue;
+        }
+        if (F->Materialize(&err)) {
+            errs() << F->getName() << ": " << err << "\n";
+            return 1;
+        }
+        passManager.run(*F);
+        const FunctionStats &stats = collect->getStats();
+        if (!totalsOnly) {
+            stats.print(outs(), withOpcodes);
+        }
+        totals.add(stats);
+        functions++;
+        if (F->isDematerializable()) {
+            F->Dematerialize();
+        }
+    }
+    passManager.doFinalization();
+
+    outs() << functions << " functions, peak RSS "
+           << format("%.1f", peakRSSMegabytes()) << " MB\n";
+    totals.print(outs(), true);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "FunctionStats.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+using namespace llvm;
+
+void FunctionStats::add(const FunctionStats &other) {
+    for (std::map<std::string, unsigned>::const_iterator i = other.opcodes.begin(),
+         e = other.opcodes.end(); i != e; ++i) {
+        opcodes[i->first] += i->second;
+    }
+    instructions += other.instructions;
+    blocks += other.blocks;
+    phis += other.phis;
+    phiOperands += other.phiOperands;
+    numLoops += other.numLoops;
+    maxLoopDepth = std::max(maxLoopDepth, other.maxLoopDepth);
+    loopBlocks += other.loopBlocks;
+    loopInstructions += other.loopInstructions;
+}
+
+void FunctionStats::print(raw_ostream &os, bool withOpcodes) const {
+    os << name << ": " << instructions << " instructions, " << blocks << " blocks, "
+       << phis << " phis (" << phiOperands << " operands), " << numLoops
+       << " loops (max depth " << maxLoopDepth << ", " << loopInstructions
+       << " instructions in " << loopBlocks << " blocks)\n";
+    if (withOpcodes) {
+        for (std::map<std::string, unsigned>::const_iterator i = opcodes.begin(),
+             e = opcodes.end(); i != e; ++i) {
+            os << "  " << i->first << ": " << i->second << "\n";
+        }
+    }
+}
+
+static void addLoop(Loop *L, FunctionStats &stats) {
+    LoopStats loop;
+    loop.header = L->getHeader()->getName();
+    loop.depth = L->getLoopDepth();
+    loop.blocks = L->getNumBlocks();
+    loop.instructions = 0;
+    for (Loop::block_iterator bb = L->block_begin(), e = L->block_end(); bb != e; ++bb) {
+        loop.instructions += (*bb)->size();
+    }
+    stats.loops.push_back(loop);
+    stats.numLoops++;
+    stats.maxLoopDepth = std::max(stats.maxLoopDepth, loop.depth);
+    stats.loopBlocks += loop.blocks;
+    stats.loopInstructions += loop.instructions;
+    for (Loop::iterator i = L->begin(), e = L->end(); i != e; ++i) {
+        addLoop(*i, stats);
+    }
+}
+
+void CollectFunctionStats::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.addRequired<LoopInfo>();
+    AU.setPreservesAll();
+}
+
+bool CollectFunctionStats::runOnFunction(Function &F) {
+    stats = FunctionStats();
+    stats.name = F.getName();
+    for (Function::iterator bb = F.begin(), e = F.end(); bb != e; ++bb) {
+        stats.blocks++;
+        for (BasicBlock::iterator i = bb->begin(), o = bb->end(); i != o; ++i) {
+            stats.instructions++;
+            stats.opcodes[i->getOpcodeName()]++;
+            if (PHINode *PN = dyn_cast<PHINode>(i)) {
+                stats.phis++;
+                stats.phiOperands += PN->getNumIncomingValues();
+            }
+        }
+    }
+    LoopInfo &LI = getAnalysis<LoopInfo>();
+    for (LoopInfo::iterator i = LI.begin(), e = LI.end(); i != e; ++i) {
+        addLoop(*i, stats);
+    }
+    return false;
+}
+
+char CollectFunctionStats::ID = 0;
@@ -0,0 +1,67 @@
+//===- FunctionStats.h ----------------------------------------------------===//
+//
+// The numbers the opCounter, countphis and bbCounter passes print, collected
+// into a struct so tools can aggregate and compare them.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FUNCTION_STATS_H
+#define FUNCTION_STATS_H
+
+#include "llvm/Pass.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class raw_ostream;
+}
+
+struct LoopStats {
+    std::string header; // name of the header block
+    unsigned depth;     // 1 for outermost loops
+    unsigned blocks;
+    unsigned instructions;
+};
+
+struct FunctionStats {
+    FunctionStats()
+        : instructions(0), blocks(0), phis(0), phiOperands(0),
+          numLoops(0), maxLoopDepth(0), loopBlocks(0), loopInstructions(0) {}
+
+    std::string name;
+    std::map<std::string, unsigned> opcodes;
+    unsigned instructions;
+    unsigned blocks;
+    unsigned phis;
+    unsigned phiOperands;
+    // Summary of the loops below, kept when stats are added up.
+    unsigned numLoops;
+    unsigned maxLoopDepth;
+    unsigned long loopBlocks;
+    unsigned long loopInstructions;
+    // Every loop of the function, outer loops before the loops they contain.
+    std::vector<LoopStats> loops;
+
+    // Adds other's counts; loops stay per function, only their summary is
+    // added, so totals do not grow with the module.
+    void add(const FunctionStats &other);
+    void print(llvm::raw_ostream &os, bool withOpcodes) const;
+};
+
+// Collects the FunctionStats of each function it runs on; getStats() holds
+// the last one.
+struct CollectFunctionStats : public llvm::FunctionPass {
+    static char ID;
+    CollectFunctionStats() : llvm::FunctionPass(ID) {}
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+    virtual bool runOnFunction(llvm::Function &F);
+
+    const FunctionStats &getStats() const { return stats; }
+
+private:
+    FunctionStats stats;
+};
+
+#endif
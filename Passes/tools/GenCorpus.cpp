@@ -0,0 +1,233 @@
+//===- GenCorpus.cpp ------------------------------------------------------===//
+//
+// Writes bitcode inputs for pass-bench.
+//
+//   gen-corpus [-functions N] [-depth D] [-phis P] -o out.bc
+//     N functions, each a nest of D loops carrying P accumulators, so every
+//     loop header has P + 1 phis and every innermost body a diamond with P
+//     more.
+//
+//   gen-corpus -replicate N -o out.bc in.bc
+//     N copies of the definitions in in.bc, e.g. one of the tests/*.c
+//     programs, renamed apart and linked into one module.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+using namespace llvm;
+
+namespace {
+    struct Generator {
+        Module *M;
+        LLVMContext &C;
+        IRBuilder<> B;
+        Function *F;
+        Value *N;
+        unsigned depth, phis;
+
+        Generator(Module *M, unsigned depth, unsigned phis)
+            : M(M), C(M->getContext()), B(C), F(0), N(0), depth(depth), phis(phis) {}
+
+        // Innermost body: mixes the accumulators with the induction
+        // variables and merges two arms, one phi per accumulator.
+        std::vector<Value *> genBody(const std::vector<Value *> &accs, Value *iv) {
+            std::vector<Value *> mixed(accs.size());
+            for (unsigned i = 0; i < accs.size(); ++i) {
+                Value *next = accs[(i + 1) % accs.size()];
+                mixed[i] = B.CreateAdd(B.CreateMul(accs[i], B.getInt32(3 + i)),
+                                       B.CreateXor(next, iv));
+            }
+            BasicBlock *odd = BasicBlock::Create(C, "odd", F);
+            BasicBlock *even = BasicBlock::Create(C, "even", F);
+            BasicBlock *merge = BasicBlock::Create(C, "merge", F);
+            B.CreateCondBr(B.CreateICmpNE(B.CreateAnd(mixed[0], B.getInt32(1)), B.getInt32(0)),
+                           odd, even);
+            std::vector<Value *> oddValues(accs.size()), evenValues(accs.size());
+            B.SetInsertPoint(odd);
+            for (unsigned i = 0; i < accs.size(); ++i) {
+                oddValues[i] = B.CreateLShr(mixed[i], B.getInt32(1));
+            }
+            B.CreateBr(merge);
+            B.SetInsertPoint(even);
+            for (unsigned i = 0; i < accs.size(); ++i) {
+                evenValues[i] = B.CreateSub(mixed[i], iv);
+            }
+            B.CreateBr(merge);
+            B.SetInsertPoint(merge);
+            std::vector<Value *> merged(accs.size());
+            for (unsigned i = 0; i < accs.size(); ++i) {
+                PHINode *phi = B.CreatePHI(B.getInt32Ty(), 2, "acc");
+                phi->addIncoming(oddValues[i], odd);
+                phi->addIncoming(evenValues[i], even);
+                merged[i] = phi;
+            }
+            return merged;
+        }
+
+        std::vector<Value *> genLoop(unsigned level, const std::vector<Value *> &accs, Value *outerIv) {
+            if (level == depth) {
+                return genBody(accs, outerIv);
+            }
+            BasicBlock *preheader = B.GetInsertBlock();
+            BasicBlock *header = BasicBlock::Create(C, "header", F);
+            BasicBlock *body = BasicBlock::Create(C, "body", F);
+            BasicBlock *exit = BasicBlock::Create(C, "exit", F);
+            B.CreateBr(header);
+
+            B.SetInsertPoint(header);
+            PHINode *iv = B.CreatePHI(B.getInt32Ty(), 2, "iv");
+            iv->addIncoming(B.getInt32(0), preheader);
+            std::vector<PHINode *> headerPhis(accs.size());
+            std::vector<Value *> current(accs.size());
+            for (unsigned i = 0; i < accs.size(); ++i) {
+                headerPhis[i] = B.CreatePHI(B.getInt32Ty(), 2, "acc");
+                headerPhis[i]->addIncoming(accs[i], preheader);
+                current[i] = headerPhis[i];
+            }
+            B.CreateCondBr(B.CreateICmpSLT(iv, N), body, exit);
+
+            B.SetInsertPoint(body);
+            std::vector<Value *> inner = genLoop(level + 1, current, B.CreateAdd(iv, outerIv));
+            Value *ivNext = B.CreateAdd(iv, B.getInt32(1), "iv.next");
+            iv->addIncoming(ivNext, B.GetInsertBlock());
+            for (unsigned i = 0; i < accs.size(); ++i) {
+                headerPhis[i]->addIncoming(inner[i], B.GetInsertBlock());
+            }
+            B.CreateBr(header);
+
+            B.SetInsertPoint(exit);
+            return current;
+        }
+
+        void genFunction(const std::string &name) {
+            Type *intTy = B.getInt32Ty();
+            F = cast<Function>(M->getOrInsertFunction(name, intTy, intTy, intTy, (Type *)0));
+            Function::arg_iterator args = F->arg_begin();
+            N = args++;
+            N->setName("n");
+            Value *seed = args;
+            seed->setName("seed");
+            B.SetInsertPoint(BasicBlock::Create(C, "entry", F));
+            std::vector<Value *> accs(phis);
+            for (unsigned i = 0; i < phis; ++i) {
+                accs[i] = B.CreateAdd(seed, B.getInt32(i));
+            }
+            std::vector<Value *> result = genLoop(0, accs, seed);
+            Value *sum = B.getInt32(0);
+            for (unsigned i = 0; i < result.size(); ++i) {
+                sum = B.CreateXor(sum, result[i]);
+            }
+            B.CreateRet(sum);
+        }
+    };
+}
+
+// Appends copies of src's definitions to dest; renaming the definitions
+// of a copy before linking keeps the copies apart. One Linker links every
+// copy: a new one would rescan the types of the growing dest each time.
+static bool replicate(Module *dest, const Module *src, unsigned copies, std::string &err) {
+    Linker linker(dest);
+    for (unsigned k = 0; k < copies; ++k) {
+        Module *copy = CloneModule(src);
+        std::string suffix = "." + utostr(k);
+        for (Module::iterator F = copy->begin(), E = copy->end(); F != E; ++F) {
+            if (!F->isDeclaration()) {
+                F->setName(F->getName() + suffix);
+            }
+        }
+        for (Module::global_iterator G = copy->global_begin(), E = copy->global_end(); G != E; ++G) {
+            if (!G->isDeclaration()) {
+                G->setName(G->getName() + suffix);
+            }
+        }
+        if (linker.linkInModule(copy, Linker::DestroySource, &err)) {
+            delete copy;
+            return false;
+        }
+        delete copy;
+    }
+    return true;
+}
+
+static void usage() {
+    errs() << "usage: gen-corpus [-functions N] [-depth D] [-phis P] -o <out.bc>\n"
+           << "       gen-corpus -replicate N -o <out.bc> <in.bc>\n";
+}
+
+int main(int argc, char **argv) {
+    unsigned functions = 100, depth = 3, phis = 4, copies = 0;
+    const char *output = 0, *input = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-functions") && i + 1 < argc) {
+            functions = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-depth") && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-phis") && i + 1 < argc) {
+            phis = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "-replicate") && i + 1 < argc) {
+            copies = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] != '-' && !input) {
+            input = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (!output || (copies > 0) != (input != 0)) {
+        usage();
+        return 1;
+    }
+
+    LLVMContext context;
+    OwningPtr<Module> module(new Module(output, context));
+    if (input) {
+        SMDiagnostic diag;
+        OwningPtr<Module> src(ParseIRFile(input, diag, context));
+        if (!src) {
+            diag.print(argv[0], errs());
+            return 1;
+        }
+        module->setTargetTriple(src->getTargetTriple());
+        module->setDataLayout(src->getDataLayout());
+        std::string err;
+        if (!replicate(module.get(), src.get(), copies, err)) {
+            errs() << input << ": " << err << "\n";
+            return 1;
+        }
+    } else {
+        Generator generator(module.get(), depth, phis);
+        for (unsigned i = 0; i < functions; ++i) {
+            generator.genFunction("loops" + utostr(i));
+        }
+    }
+
+    std::string errorInfo;
+    tool_output_file out(output, errorInfo, sys::fs::F_Binary);
+    if (!errorInfo.empty()) {
+        errs() << errorInfo << "\n";
+        return 1;
+    }
+    WriteBitcodeToFile(module.get(), out.os());
+    out.keep();
+    return 0;
+}
@@ -0,0 +1,340 @@
+//===- OptDiff.cpp --------------------------------------------------------===//
+//
+// What a pass pipeline did to each function and loop of a module: the
+// opCounter/bbCounter statistics before and after it, as deltas.
+//
+//   opt-diff [-pipeline jit|O1|O2|O3] [-passes a,b] [-j N] [-check] <file>...
+//
+// "jit" (the default) is the optimizeFunction set of the JIT driver:
+// instcombine, reassociate, gvn and simplifycfg. -passes runs registered
+// passes by name instead. Inputs are bitcode or IR files and are processed
+// in parallel, each in its own context; reports come out in input order.
+// -check fails when a function grew, or when no function of a file shrank.
+//
+//===----------------------------------------------------------------------===//
+
+#include "FunctionStats.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/PassManager.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace llvm;
+
+namespace {
+    struct Options {
+        std::string pipeline;
+        std::vector<std::string> passes;
+        bool check;
+    };
+
+    typedef std::map<std::string, FunctionStats> ModuleStats;
+
+    // Loads and stores are what the JIT set is mostly expected to remove
+    // from -O0 code, so they get their own columns.
+    unsigned opcodeCount(const FunctionStats &stats, const char *opcode) {
+        std::map<std::string, unsigned>::const_iterator i = stats.opcodes.find(opcode);
+        return i == stats.opcodes.end() ? 0 : i->second;
+    }
+}
+
+static void collect(Module &M, ModuleStats &result) {
+    FunctionPassManager passManager(&M);
+    CollectFunctionStats *stats = new CollectFunctionStats();
+    passManager.add(stats);
+    passManager.doInitialization();
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+        if (F->isDeclaration()) {
+            continue;
+        }
+        passManager.run(*F);
+        result[F->getName()] = stats->getStats();
+    }
+    passManager.doFinalization();
+}
+
+// Release builds of clang emit unnamed blocks; instnamer gives every block
+// a unique name so loops can be matched by header across the pipeline.
+static void nameValues(Module &M) {
+    FunctionPassManager passManager(&M);
+    passManager.add(createInstructionNamerPass());
+    passManager.doInitialization();
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+        passManager.run(*F);
+    }
+    passManager.doFinalization();
+}
+
+static void optimize(Module &M, const Options &options) {
+    FunctionPassManager functionPasses(&M);
+    PassManager modulePasses;
+    if (!M.getDataLayout().empty()) {
+        functionPasses.add(new DataLayout(&M));
+        modulePasses.add(new DataLayout(&M));
+    }
+    if (!options.passes.empty()) {
+        for (unsigned i = 0; i < options.passes.size(); ++i) {
+            const PassInfo *info = PassRegistry::getPassRegistry()->getPassInfo(options.passes[i]);
+            modulePasses.add(info->createPass());
+        }
+    } else if (options.pipeline == "jit") {
+        functionPasses.add(createInstructionCombiningPass());
+        functionPasses.add(createReassociatePass());
+        functionPasses.add(createGVNPass());
+        functionPasses.add(createCFGSimplificationPass());
+    } else {
+        // What opt -O<n> sets up.
+        PassManagerBuilder builder;
+        builder.OptLevel = options.pipeline[1] - '0';
+        if (builder.OptLevel > 1) {
+            builder.Inliner = createFunctionInliningPass(builder.OptLevel > 2 ? 250 : 225);
+        } else {
+            builder.Inliner = createAlwaysInlinerPass();
+        }
+        builder.populateFunctionPassManager(functionPasses);
+        builder.populateModulePassManager(modulePasses);
+    }
+    functionPasses.doInitialization();
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+        functionPasses.run(*F);
+    }
+    functionPasses.doFinalization();
+    modulePasses.run(M);
+}
+
+static void printDelta(raw_ostream &os, const char *what, long before, long after) {
+    os << what << " " << before << " -> " << after;
+    if (after != before) {
+        os << " (" << (after > before ? "+" : "") << after - before << ")";
+    }
+}
+
+// Header name of loop i, or its preorder position when the header has no name.
+static std::string loopLabel(const FunctionStats &stats, unsigned i) {
+    if (!stats.loops[i].header.empty()) {
+        return stats.loops[i].header;
+    }
+    return "<unnamed #" + utostr(i) + ">";
+}
+
+static void printFunction(raw_ostream &os, const FunctionStats &before, const FunctionStats &after) {
+    os << before.name << ": ";
+    printDelta(os, "instructions", before.instructions, after.instructions);
+    os << ", ";
+    printDelta(os, "blocks", before.blocks, after.blocks);
+    os << ", ";
+    printDelta(os, "loads", opcodeCount(before, "load"), opcodeCount(after, "load"));
+    os << ", ";
+    printDelta(os, "stores", opcodeCount(before, "store"), opcodeCount(after, "store"));
+    os << "\n";
+
+    std::map<std::string, long> opcodes;
+    for (std::map<std::string, unsigned>::const_iterator i = before.opcodes.begin(),
+         e = before.opcodes.end(); i != e; ++i) {
+        opcodes[i->first] -= (long)i->second;
+    }
+    for (std::map<std::string, unsigned>::const_iterator i = after.opcodes.begin(),
+         e = after.opcodes.end(); i != e; ++i) {
+        opcodes[i->first] += (long)i->second;
+    }
+    bool first = true;
+    for (std::map<std::string, long>::const_iterator i = opcodes.begin(), e = opcodes.end(); i != e; ++i) {
+        if (i->second == 0) {
+            continue;
+        }
+        os << (first ? "    " : ", ") << i->first << " " << (i->second > 0 ? "+" : "") << i->second;
+        first = false;
+    }
+    if (!first) {
+        os << "\n";
+    }
+
+    // Loops are matched by header name, which the passes mostly keep.
+    // Headers a pass left unnamed are matched by depth and preorder index
+    // instead. Loops without a match were removed or created by the pipeline.
+    std::map<std::string, unsigned> afterByName;
+    std::map<std::pair<unsigned, unsigned>, unsigned> afterUnnamed;
+    for (unsigned i = 0; i < after.loops.size(); ++i) {
+        if (after.loops[i].header.empty()) {
+            afterUnnamed[std::make_pair(after.loops[i].depth, i)] = i;
+        } else {
+            afterByName[after.loops[i].header] = i;
+        }
+    }
+    std::vector<bool> matched(after.loops.size());
+    for (unsigned i = 0; i < before.loops.size(); ++i) {
+        const LoopStats &loop = before.loops[i];
+        os << "  loop " << loopLabel(before, i) << " (depth " << loop.depth << "): ";
+        int match = -1;
+        std::map<std::string, unsigned>::iterator byName = afterByName.find(loop.header);
+        if (!loop.header.empty() && byName != afterByName.end()) {
+            match = byName->second;
+        } else {
+            std::map<std::pair<unsigned, unsigned>, unsigned>::iterator byIndex =
+                afterUnnamed.find(std::make_pair(loop.depth, i));
+            if (byIndex != afterUnnamed.end()) {
+                match = byIndex->second;
+            }
+        }
+        if (match < 0 || matched[match]) {
+            os << "gone\n";
+            continue;
+        }
+        matched[match] = true;
+        printDelta(os, "instructions", loop.instructions, after.loops[match].instructions);
+        os << ", ";
+        printDelta(os, "blocks", loop.blocks, after.loops[match].blocks);
+        os << "\n";
+    }
+    for (unsigned i = 0; i < after.loops.size(); ++i) {
+        if (matched[i]) {
+            continue;
+        }
+        os << "  loop " << loopLabel(after, i) << " (depth " << after.loops[i].depth << "): new, "
+           << after.loops[i].instructions << " instructions, " << after.loops[i].blocks << " blocks\n";
+    }
+}
+
+// Returns false if the file cannot be read or -check fails on it.
+static bool diffFile(const char *path, const Options &options, raw_ostream &os) {
+    LLVMContext context;
+    SMDiagnostic diag;
+    OwningPtr<Module> module(ParseIRFile(path, diag, context));
+    os << "== " << path << " (" << (options.passes.empty() ? options.pipeline : "passes") << ")\n";
+    if (!module) {
+        diag.print("opt-diff", os);
+        return false;
+    }
+    ModuleStats before, after;
+    nameValues(*module);
+    collect(*module, before);
+    optimize(*module, options);
+    collect(*module, after);
+
+    bool grew = false, shrank = false;
+    for (ModuleStats::iterator i = before.begin(), e = before.end(); i != e; ++i) {
+        ModuleStats::iterator match = after.find(i->first);
+        if (match == after.end()) {
+            os << i->first << ": removed (" << i->second.instructions << " instructions)\n";
+            shrank = true;
+            continue;
+        }
+        printFunction(os, i->second, match->second);
+        grew |= match->second.instructions > i->second.instructions;
+        shrank |= match->second.instructions < i->second.instructions;
+    }
+    for (ModuleStats::iterator i = after.begin(), e = after.end(); i != e; ++i) {
+        if (!before.count(i->first)) {
+            os << i->first << ": new (" << i->second.instructions << " instructions)\n";
+        }
+    }
+    if (options.check && (grew || !shrank)) {
+        os << "CHECK FAILED: " << (grew ? "a function grew" : "nothing shrank") << "\n";
+        return false;
+    }
+    return true;
+}
+
+static void usage() {
+    errs() << "usage: opt-diff [-pipeline jit|O1|O2|O3] [-passes a,b] [-j N] [-check] <file>...\n";
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    options.pipeline = "jit";
+    options.check = false;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-pipeline") && i + 1 < argc) {
+            options.pipeline = argv[++i];
+        } else if (!strcmp(argv[i], "-passes") && i + 1 < argc) {
+            std::string list = argv[++i];
+            for (size_t start = 0, end; start <= list.size(); start = end + 1) {
+                end = list.find(',', start);
+                if (end == std::string::npos) {
+                    end = list.size();
+                }
+                options.passes.push_back(list.substr(start, end - start));
+            }
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            jobs = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "-check")) {
+            options.check = true;
+        } else if (argv[i][0] != '-') {
+            files.push_back(argv[i]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (files.empty() || (options.pipeline != "jit" && options.pipeline != "O1" &&
+                          options.pipeline != "O2" && options.pipeline != "O3")) {
+        usage();
+        return 1;
+    }
+
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeScalarOpts(registry);
+    initializeVectorization(registry);
+    initializeIPO(registry);
+    initializeAnalysis(registry);
+    initializeIPA(registry);
+    initializeTransformUtils(registry);
+    initializeInstCombine(registry);
+    for (unsigned i = 0; i < options.passes.size(); ++i) {
+        if (!registry.getPassInfo(options.passes[i])) {
+            errs() << "unknown pass '" << options.passes[i] << "'\n";
+            return 1;
+        }
+    }
+
+    // Each file gets its own LLVMContext; the pass registry is shared.
+    llvm_start_multithreaded();
+    std::vector<std::string> reports(files.size());
+    std::vector<char> passed(files.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    jobs = std::min<size_t>(jobs, files.size());
+    for (unsigned w = 0; w < jobs; ++w) {
+        workers.push_back(std::thread([&] {
+            for (size_t i = next++; i < files.size(); i = next++) {
+                raw_string_ostream os(reports[i]);
+                passed[i] = diffFile(files[i], options, os);
+            }
+        }));
+    }
+    for (unsigned w = 0; w < workers.size(); ++w) {
+        workers[w].join();
+    }
+
+    unsigned failed = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        outs() << reports[i] << "\n";
+        failed += !passed[i];
+    }
+    if (failed) {
+        errs() << failed << " of " << files.size() << " files failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,302 @@
+//===- PassBench.cpp ------------------------------------------------------===//
+//
+// Times the opCounter, countphis and bbCounter passes over bitcode files.
+// Every (file, pass) pair runs in a child process, so its peak RSS comes
+// from wait4() and does not carry over from earlier runs; the pass output
+// goes to /dev/null.
+//
+//   pass-bench [-runs N] [-passes a,b] [-baseline file [-update]]
+//              [-tolerance PCT] <file.bc>...
+//
+// With -baseline, results are compared with the stored ones and the exit
+// status is 1 when a pass got more than PCT percent (default 25) slower or
+// bigger; -update rewrites the baseline from this run instead. A baseline
+// recorded with another -runs is refused, and a file whose instruction
+// count differs from the baseline's fails as a different input.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/PassManager.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <string>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+using namespace llvm;
+
+namespace {
+    struct Result {
+        Result() : instructions(0), loadMs(0), passMs(0), rssKB(0) {}
+        unsigned long long instructions;
+        double loadMs, passMs;
+        long rssKB;
+    };
+
+    struct BaselineEntry {
+        double passMs;
+        long rssKB;
+        unsigned long long instructions;
+    };
+
+    // What a child writes back through its pipe.
+    struct ChildReport {
+        unsigned long long instructions;
+        double loadMs, passMs;
+        int ok;
+    };
+}
+
+static double nowMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+static std::string baseName(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static void runChild(const char *path, const char *passName, int fd) {
+    ChildReport report = { 0, 0, 0, 0 };
+    int devNull = open("/dev/null", O_WRONLY);
+    if (devNull >= 0) {
+        dup2(devNull, 2);
+    }
+    LLVMContext context;
+    SMDiagnostic diag;
+    double start = nowMs();
+    OwningPtr<Module> module(ParseIRFile(path, diag, context));
+    const PassInfo *info = PassRegistry::getPassRegistry()->getPassInfo(passName);
+    if (module && info) {
+        report.loadMs = nowMs() - start;
+        for (Module::iterator F = module->begin(), E = module->end(); F != E; ++F) {
+            for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+                report.instructions += BB->size();
+            }
+        }
+        PassManager passManager;
+        passManager.add(info->createPass());
+        start = nowMs();
+        passManager.run(*module);
+        report.passMs = nowMs() - start;
+        report.ok = 1;
+    }
+    if (write(fd, &report, sizeof(report)) != sizeof(report)) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+static bool runOnce(const char *path, const char *passName, Result &result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        runChild(path, passName, fds[1]);
+    }
+    close(fds[1]);
+    ChildReport report;
+    bool ok = pid > 0 && read(fds[0], &report, sizeof(report)) == sizeof(report) && report.ok;
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (pid > 0 && wait4(pid, &status, 0, &usage) == pid && ok) {
+        result.instructions = report.instructions;
+        result.loadMs = report.loadMs;
+        result.passMs = report.passMs;
+#ifdef __APPLE__
+        result.rssKB = usage.ru_maxrss / 1024;
+#else
+        result.rssKB = usage.ru_maxrss;
+#endif
+        return true;
+    }
+    return false;
+}
+
+typedef std::map<std::string, BaselineEntry> Baseline;
+
+// A "params runs N" line, then one "file pass ms KB instructions" line
+// per result; runs is 0 if the params line is missing.
+static void readBaseline(const char *path, Baseline &baseline, unsigned &runs) {
+    std::ifstream in(path);
+    std::string line;
+    runs = 0;
+    if (std::getline(in, line) && line.compare(0, 12, "params runs ") == 0) {
+        runs = strtoul(line.c_str() + 12, NULL, 10);
+    }
+    std::string file, pass;
+    BaselineEntry entry;
+    while (in >> file >> pass >> entry.passMs >> entry.rssKB >> entry.instructions) {
+        baseline[file + " " + pass] = entry;
+    }
+}
+
+static void usage() {
+    errs() << "usage: pass-bench [-runs N] [-passes a,b] [-baseline file [-update]]\n"
+           << "                  [-tolerance PCT] <file.bc>...\n";
+}
+
+int main(int argc, char **argv) {
+    unsigned runs = 3;
+    double tolerance = 25;
+    const char *baselinePath = 0;
+    bool update = false;
+    std::vector<std::string> passes;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-runs") && i + 1 < argc) {
+            runs = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "-passes") && i + 1 < argc) {
+            std::string list = argv[++i];
+            for (size_t start = 0, end; start <= list.size(); start = end + 1) {
+                end = list.find(',', start);
+                if (end == std::string::npos) {
+                    end = list.size();
+                }
+                passes.push_back(list.substr(start, end - start));
+            }
+        } else if (!strcmp(argv[i], "-baseline") && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (!strcmp(argv[i], "-update")) {
+            update = true;
+        } else if (!strcmp(argv[i], "-tolerance") && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            files.push_back(argv[i]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (files.empty() || (update && !baselinePath)) {
+        usage();
+        return 1;
+    }
+    if (passes.empty()) {
+        passes.push_back("opCounter");
+        passes.push_back("countphis");
+        passes.push_back("bbCounter");
+    }
+
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeAnalysis(registry);
+    for (unsigned p = 0; p < passes.size(); ++p) {
+        if (!registry.getPassInfo(passes[p])) {
+            errs() << "unknown pass '" << passes[p] << "'\n";
+            return 1;
+        }
+    }
+
+    Baseline baseline;
+    if (baselinePath && !update) {
+        unsigned baseRuns;
+        readBaseline(baselinePath, baseline, baseRuns);
+        if (baseline.empty()) {
+            errs() << "no baseline in " << baselinePath << ", create one with -update\n";
+        } else if (baseRuns != runs) {
+            errs() << baselinePath << " was recorded with -runs " << baseRuns << ", not "
+                   << runs << "; rerun with those or -update\n";
+            return 1;
+        }
+    }
+    std::string updated = "params runs " + utostr(runs) + "\n";
+    unsigned regressions = 0;
+
+    outs() << format("%-24s %-10s %10s %9s %9s %8s %9s\n", "file", "pass",
+                     "instrs", "load ms", "pass ms", "RSS MB", "Minstr/s");
+    for (unsigned f = 0; f < files.size(); ++f) {
+        for (unsigned p = 0; p < passes.size(); ++p) {
+            // Fastest run and smallest peak, to keep noise out of the baseline.
+            Result best;
+            bool ok = false;
+            for (unsigned r = 0; r < runs; ++r) {
+                Result result;
+                if (!runOnce(files[f], passes[p].c_str(), result)) {
+                    continue;
+                }
+                if (!ok || result.passMs < best.passMs) {
+                    long rssKB = ok ? std::min(best.rssKB, result.rssKB) : result.rssKB;
+                    best = result;
+                    best.rssKB = rssKB;
+                } else {
+                    best.rssKB = std::min(best.rssKB, result.rssKB);
+                }
+                ok = true;
+            }
+            std::string file = baseName(files[f]);
+            if (!ok) {
+                errs() << file << ": " << passes[p] << " failed\n";
+                regressions++;
+                continue;
+            }
+            double rate = best.passMs > 0 ? best.instructions / (best.passMs * 1e3) : 0;
+            outs() << format("%-24s %-10s %10llu %9.1f %9.1f %8.1f %9.1f",
+                             file.c_str(), passes[p].c_str(), best.instructions,
+                             best.loadMs, best.passMs, best.rssKB / 1024.0, rate);
+
+            std::string key = file + " " + passes[p];
+            if (update) {
+                char line[96];
+                snprintf(line, sizeof(line), " %.3f %ld %llu\n",
+                         best.passMs, best.rssKB, best.instructions);
+                updated += key + line;
+            } else if (baseline.count(key) && baseline[key].instructions != best.instructions) {
+                outs() << format("  DIFFERENT INPUT (baseline %llu instrs)",
+                                 baseline[key].instructions);
+                regressions++;
+            } else if (baseline.count(key)) {
+                double baseMs = baseline[key].passMs;
+                long baseKB = baseline[key].rssKB;
+                // Sub-millisecond passes are all noise; give them 1 ms of slack.
+                bool slower = best.passMs > baseMs * (1 + tolerance / 100) + 1;
+                bool bigger = best.rssKB > baseKB * (1 + tolerance / 100);
+                if (slower || bigger) {
+                    outs() << format("  REGRESSION (baseline %.1f ms, %.1f MB)",
+                                     baseMs, baseKB / 1024.0);
+                    regressions++;
+                }
+            }
+            outs() << "\n";
+        }
+    }
+
+    if (update) {
+        std::string errorInfo;
+        raw_fd_ostream out(baselinePath, errorInfo);
+        if (!errorInfo.empty()) {
+            errs() << errorInfo << "\n";
+            return 1;
+        }
+        out << updated;
+        outs() << "baseline written to " << baselinePath << "\n";
+    }
+    if (regressions) {
+        outs() << regressions << " regressions\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+//===- RegAllocReport.cpp -------------------------------------------------===//
+//
+// Runs the code generator of the host target over a bitcode or IR file
+// with the regallocReport pass (src/RegAlloc_Report.cpp) inserted right
+// after the virtual register rewriter, and discards the machine code.
+//
+//   regalloc-report [-O1|-O2|-O3] <file.bc>
+//
+// -O0 uses the fast register allocator, which has no rewriter to hook.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/CodeGen/MachineFunctionAnalysis.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/Passes.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/PassManager.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetLowering.h"
+#include "llvm/Target/TargetLoweringObjectFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include <cstring>
+using namespace llvm;
+
+static void usage() {
+    errs() << "usage: regalloc-report [-O1|-O2|-O3] <file.bc>\n";
+}
+
+int main(int argc, char **argv) {
+    CodeGenOpt::Level optLevel = CodeGenOpt::Default;
+    const char *path = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-O1")) {
+            optLevel = CodeGenOpt::Less;
+        } else if (!strcmp(argv[i], "-O2")) {
+            optLevel = CodeGenOpt::Default;
+        } else if (!strcmp(argv[i], "-O3")) {
+            optLevel = CodeGenOpt::Aggressive;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (!path) {
+        usage();
+        return 1;
+    }
+
+    InitializeNativeTarget();
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeCodeGen(registry);
+    initializeLoopStrengthReducePass(registry);
+    initializeLowerIntrinsicsPass(registry);
+    initializeUnreachableBlockElimPass(registry);
+
+    LLVMContext context;
+    SMDiagnostic diag;
+    OwningPtr<Module> module(ParseIRFile(path, diag, context));
+    if (!module) {
+        diag.print(argv[0], errs());
+        return 1;
+    }
+    std::string triple = module->getTargetTriple();
+    if (triple.empty()) {
+        triple = sys::getDefaultTargetTriple();
+    }
+    std::string err;
+    const Target *target = TargetRegistry::lookupTarget(triple, err);
+    if (!target) {
+        errs() << err << "\n";
+        return 1;
+    }
+    OwningPtr<TargetMachine> machine(
+        target->createTargetMachine(triple, sys::getHostCPUName(), "", TargetOptions(),
+                                    Reloc::Default, CodeModel::Default, optLevel));
+
+    // What LLVMTargetMachine::addPassesToEmitFile does up to the machine
+    // passes, which leaves a window to insert the report: asking it to
+    // stop after the rewriter would also drop passes inserted after it.
+    const PassInfo *report = registry.getPassInfo("regallocReport");
+    PassManager passManager;
+    passManager.add(new DataLayout(*machine->getDataLayout()));
+    machine->addAnalysisPasses(passManager);
+    TargetPassConfig *passConfig =
+        static_cast<LLVMTargetMachine *>(machine.get())->createPassConfig(passManager);
+    passManager.add(passConfig);
+    passConfig->insertPass(&VirtRegRewriterID, report->getTypeInfo());
+    passConfig->addIRPasses();
+    passConfig->addCodeGenPrepare();
+    passConfig->addPassesToHandleExceptions();
+    passConfig->addISelPrepare();
+    passManager.add(new MachineModuleInfo(*machine->getMCAsmInfo(), *machine->getRegisterInfo(),
+                                          &machine->getTargetLowering()->getObjFileLowering()));
+    passManager.add(new MachineFunctionAnalysis(*machine));
+    if (passConfig->addInstSelector()) {
+        errs() << "The target has no instruction selector.\n";
+        return 1;
+    }
+    passConfig->addMachinePasses();
+    passConfig->setInitialized();
+    passManager.run(*module);
+    return 0;
+}
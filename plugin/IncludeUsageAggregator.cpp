@@ -0,0 +1,221 @@
+//===- IncludeUsageAggregator.cpp -----------------------------------------===//
+//
+// Merges the per-TU include usage records written by the print-fnso plugin
+// (-plugin-arg-print-fnso db=<dir>) and reports the project-wide include
+// cost hotspots: headers that are included often but rarely used.
+//
+//   make include-usage-aggregate
+//   include-usage-aggregate [-j N] [-top K] <db dir>
+//
+// The saving estimate charges each TU's frontend time to its headers in
+// proportion to the bytes they pull in, and sums that share over the TUs
+// where the include is unused.
+//
+//===----------------------------------------------------------------------===//
+
+#include "IncludeUsageDB.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace include_usage_db;
+
+namespace {
+
+struct HeaderStats {
+    unsigned tus_including = 0;
+    unsigned tus_using = 0;
+    uint64_t uses = 0;
+    uint64_t bytes = 0;
+    double saved_ms = 0;
+    std::map<std::string, unsigned> symbols;
+
+    void merge(const HeaderStats &other)
+    {
+        tus_including += other.tus_including;
+        tus_using += other.tus_using;
+        uses += other.uses;
+        bytes += other.bytes;
+        saved_ms += other.saved_ms;
+        for (const auto &it : other.symbols) symbols[it.first] += it.second;
+    }
+};
+
+struct Totals {
+    unsigned tus = 0;
+    unsigned bad_records = 0;
+    uint64_t bytes = 0;
+    double time_ms = 0;
+    double saved_ms = 0;
+};
+
+typedef std::unordered_map<std::string, HeaderStats> HeaderTable;
+
+static void add_record(const TURecord &record, HeaderTable &headers, Totals &totals)
+{
+    totals.tus++;
+    totals.bytes += record.bytes;
+    totals.time_ms += record.time_ms;
+    for (const IncludeRecord &inc : record.includes) {
+        /* headers reached through other headers are not the TU's to remove */
+        if (!inc.direct) continue;
+        HeaderStats &stats = headers[inc.header];
+        stats.tus_including++;
+        stats.uses += inc.uses;
+        stats.bytes += inc.bytes;
+        if (inc.uses > 0) {
+            stats.tus_using++;
+        } else if (record.bytes > 0) {
+            double saved = record.time_ms * (double)inc.bytes / (double)record.bytes;
+            stats.saved_ms += saved;
+            totals.saved_ms += saved;
+        }
+        for (const std::string &symbol : inc.symbols) stats.symbols[symbol]++;
+    }
+}
+
+static std::vector<std::string> list_records(const std::string &dir)
+{
+    std::vector<std::string> paths;
+    DIR *d = opendir(dir.c_str());
+    if (!d) return paths;
+    const size_t suffix_len = strlen(RECORD_SUFFIX);
+    while (struct dirent *entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() <= suffix_len) continue;
+        if (name.compare(name.size() - suffix_len, suffix_len, RECORD_SUFFIX) != 0) continue;
+        paths.push_back(dir + "/" + name);
+    }
+    closedir(d);
+    return paths;
+}
+
+/* Whole decimal number that fits an unsigned; false otherwise. */
+static bool parse_unsigned(const char *text, unsigned &value)
+{
+    char *end;
+    errno = 0;
+    const unsigned long parsed = strtoul(text, &end, 10);
+    if (!isdigit((unsigned char)text[0]) || *end || errno || parsed > UINT_MAX) return false;
+    value = parsed;
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: include-usage-aggregate [-j N] [-top K] <db dir>\n");
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    unsigned top = 30;
+    std::string dir;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            if (!parse_unsigned(argv[++i], jobs) || jobs == 0) {
+                usage();
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-top") && i + 1 < argc) {
+            if (!parse_unsigned(argv[++i], top)) {
+                usage();
+                return 1;
+            }
+        } else if (argv[i][0] != '-' && dir.empty()) {
+            dir = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (dir.empty()) {
+        usage();
+        return 1;
+    }
+
+    std::vector<std::string> paths = list_records(dir);
+    if (paths.empty()) {
+        fprintf(stderr, "no usage records in '%s'\n", dir.c_str());
+        return 1;
+    }
+
+    // each worker merges into its own table; tables are combined at the end
+    jobs = std::min<unsigned>(jobs, paths.size());
+    std::vector<HeaderTable> partial(jobs);
+    std::vector<Totals> partial_totals(jobs);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < jobs; ++w) {
+        workers.push_back(std::thread([&, w] {
+            for (size_t i = next++; i < paths.size(); i = next++) {
+                TURecord record;
+                if (!read_record(paths[i], record)) {
+                    partial_totals[w].bad_records++;
+                    continue;
+                }
+                add_record(record, partial[w], partial_totals[w]);
+            }
+        }));
+    }
+    for (auto &worker : workers) worker.join();
+
+    HeaderTable headers;
+    Totals totals;
+    for (unsigned w = 0; w < jobs; ++w) {
+        for (const auto &it : partial[w]) headers[it.first].merge(it.second);
+        totals.tus += partial_totals[w].tus;
+        totals.bad_records += partial_totals[w].bad_records;
+        totals.bytes += partial_totals[w].bytes;
+        totals.time_ms += partial_totals[w].time_ms;
+        totals.saved_ms += partial_totals[w].saved_ms;
+    }
+
+    std::vector<std::pair<std::string, const HeaderStats *> > sorted;
+    for (const auto &it : headers) sorted.push_back(std::make_pair(it.first, &it.second));
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, const HeaderStats *> &a,
+                                               const std::pair<std::string, const HeaderStats *> &b) {
+        if (a.second->saved_ms != b.second->saved_ms) return a.second->saved_ms > b.second->saved_ms;
+        return a.first < b.first;
+    });
+
+    printf("%u TUs, %u headers, %.1f MB parsed, %.1f ms frontend time",
+           totals.tus, (unsigned)headers.size(), totals.bytes / 1e6, totals.time_ms);
+    if (totals.bad_records) printf(", %u unreadable records", totals.bad_records);
+    printf("\nestimated saving from removing unused includes: %.1f ms (%.1f%%)\n\n",
+           totals.saved_ms, totals.time_ms > 0 ? 100.0 * totals.saved_ms / totals.time_ms : 0.0);
+
+    printf("%-40s %8s %6s %6s %10s %10s  %s\n",
+           "header", "included", "used", "use%", "avg KB", "saved ms", "top symbols");
+    for (size_t i = 0; i < sorted.size() && i < top; ++i) {
+        const HeaderStats &stats = *sorted[i].second;
+        std::vector<std::pair<unsigned, std::string> > symbols;
+        for (const auto &it : stats.symbols) symbols.push_back(std::make_pair(it.second, it.first));
+        std::sort(symbols.rbegin(), symbols.rend());
+        std::string top_symbols;
+        for (size_t s = 0; s < symbols.size() && s < 3; ++s) {
+            if (s) top_symbols += ", ";
+            top_symbols += symbols[s].second;
+        }
+        printf("%-40s %8u %6u %5.1f%% %10.1f %10.1f  %s\n",
+               sorted[i].first.c_str(), stats.tus_including, stats.tus_using,
+               100.0 * stats.tus_using / stats.tus_including,
+               stats.bytes / 1024.0 / stats.tus_including,
+               stats.saved_ms, top_symbols.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+//===- IncludeUsageDB.h ---------------------------------------------------===//
+//
+// Per-TU include usage records written by the print-fnso plugin
+// (-plugin-arg-print-fnso db=<dir>) and merged by IncludeUsageAggregator.
+//
+// One "<hash>.rec" file per translation unit, tab separated:
+//
+//   tu    <main file>  <bytes parsed>  <time ms>
+//   inc   <header>     <uses>  <bytes pulled in>  <symbol>...
+//   use   <header>     <uses>  0                  <symbol>...
+//
+// "inc" lines are headers the main file #includes itself; "use" lines are
+// headers it only uses through another header. "bytes pulled in" counts
+// the header and everything it transitively brings into the TU the first
+// time it is entered.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef INCLUDE_USAGE_DB_H
+#define INCLUDE_USAGE_DB_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace include_usage_db {
+
+static const char *const TU_TAG = "tu";
+static const char *const INCLUDE_TAG = "inc";
+static const char *const USE_TAG = "use";
+static const char *const RECORD_SUFFIX = ".rec";
+
+struct IncludeRecord {
+    std::string header;
+    /* false for a "use" line */
+    bool direct = true;
+    unsigned uses = 0;
+    uint64_t bytes = 0;
+    std::vector<std::string> symbols;
+};
+
+struct TURecord {
+    std::string main_file;
+    uint64_t bytes = 0;
+    double time_ms = 0;
+    std::vector<IncludeRecord> includes;
+};
+
+static inline std::vector<std::string> split_fields(const std::string &line)
+{
+    std::vector<std::string> fields;
+    std::size_t start = 0;
+    while (true) {
+        const std::size_t end = line.find('\t', start);
+        if (end == std::string::npos) break;
+        fields.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+    fields.push_back(line.substr(start));
+    return fields;
+}
+
+/* Returns false if the file cannot be read or is not a TU record. */
+static inline bool read_record(const std::string &path, TURecord &record)
+{
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+    std::string line;
+    bool has_tu = false;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields = split_fields(line);
+        if (fields[0] == TU_TAG && fields.size() >= 4) {
+            record.main_file = fields[1];
+            record.bytes = std::strtoull(fields[2].c_str(), nullptr, 10);
+            record.time_ms = std::strtod(fields[3].c_str(), nullptr);
+            has_tu = true;
+        } else if ((fields[0] == INCLUDE_TAG || fields[0] == USE_TAG) && fields.size() >= 4) {
+            IncludeRecord inc;
+            inc.header = fields[1];
+            inc.direct = fields[0] == INCLUDE_TAG;
+            inc.uses = std::strtoul(fields[2].c_str(), nullptr, 10);
+            inc.bytes = std::strtoull(fields[3].c_str(), nullptr, 10);
+            inc.symbols.assign(fields.begin() + 4, fields.end());
+            record.includes.push_back(inc);
+        }
+    }
+    return has_tu;
+}
+
+}
+
+#endif
@@ -16,20 +16,63 @@
 #include "clang/AST/AST.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/DeclObjC.h"
-#include "clang/ASTMatchers/ASTMatchers.h"
-#include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Basic/LLVM.h"
 #include "clang/Basic/OperatorKinds.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/HeaderSearch.h"
 #include "clang/Sema/Sema.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+#include "IncludeUsageDB.h"
+#include <chrono>
 
 using namespace std;
 using namespace clang;
 using namespace llvm;
-using namespace clang::ast_matchers;
 
 namespace {
 
+/* Plugin tracing, selected with -plugin-arg-print-fnso log=<level>. The
+ * stream expression is only evaluated when the level is enabled. */
+enum LogLevel { LOG_QUIET = 0, LOG_INFO, LOG_DEBUG, LOG_TRACE };
+static int g_log_level = LOG_QUIET;
+
+#define IC_LOG(level, stream) \
+    do { \
+        if (g_log_level >= (level)) { llvm::errs() << stream; } \
+    } while (0)
+
+struct PluginOptions {
+    /* append one JSON line per TU here, "-" for stdout */
+    std::string summary_path;
+    /* write a cross-TU usage record (see IncludeUsageDB.h) into this directory */
+    std::string db_dir;
+    /* per-header declaration tables, see DeclCache */
+    std::string decl_cache_dir;
+    /* whole-TU results, see ResultCache */
+    std::string result_cache_dir;
+};
+
+/* Per-TU result of the include cleaner, written as the structured summary. */
+struct TUSummary {
+    unsigned includes = 0;
+    unsigned declarations = 0;
+    unsigned usages = 0;
+    std::vector<std::string> unused;
+    std::vector<std::string> redundant_allowed;
+};
+
 static void emit_redundant_allowed_warn(DiagnosticsEngine &diagEngine, SourceLocation loc, std::string filename)
 {
     unsigned diagID = diagEngine.getCustomDiagID(
@@ -102,73 +145,461 @@ static std::string trim_filename(std::string name)
     // return trim_prefix(name, "./");
 }
 
-static std::string get_filename(SourceManager *source_mgr, SourceLocation loc)
+static bool is_ignored_file(const std::string &name)
 {
-    if (!loc.isValid()) return "";
-    StringRef filename = source_mgr->getFilename(loc);
-    return trim_filename(filename.str());
+    std::string ignored_prefix = "/usr/";
+    if (name.compare(0, ignored_prefix.length(), ignored_prefix) == 0) return true; // /usr/ ignore
+    std::string allowed_suffix = ".h";
+    if (name.length() >= allowed_suffix.length()) {
+        if (0 != name.compare(name.length() - allowed_suffix.length(), allowed_suffix.length(), allowed_suffix)) return true; // .h not ignore
+    }
+    return false;
 }
 
-static std::string getFilenameFromDecl(SourceManager *source_mgr, const Decl *decl)
-{
-    std::string filename = get_filename(source_mgr, decl->getLocation());
-    if (filename.length() == 0) {
-        /* For some weird reason if the declaration is
-         * behind a macro expansion sometimes it returns an
-         * empty filename above */
-        filename = get_filename(source_mgr, decl->getBeginLoc());
+/* Per-TU filename interning: every FileID is resolved to its trimmed
+ * filename once, and every distinct filename gets a dense integer id that
+ * indexes the include tables below. */
+class FileTable {
+public:
+    static const unsigned InvalidID = ~0u;
+
+    explicit FileTable(SourceManager *src_mgr) : m_src_mgr(src_mgr) {}
+
+    unsigned idForName(StringRef name)
+    {
+        auto res = m_name_ids.try_emplace(name, (unsigned)m_names.size());
+        if (res.second) m_names.push_back(name.str());
+        return res.first->second;
     }
-    if (filename.length() == 0) {
-        filename = get_filename(source_mgr, decl->getEndLoc());
+
+    unsigned idForLoc(SourceLocation loc)
+    {
+        if (!loc.isValid()) return InvalidID;
+        FileID fid = m_src_mgr->getFileID(loc);
+        auto it = m_fid_ids.find(fid);
+        if (it != m_fid_ids.end()) return it->second;
+        unsigned id = InvalidID;
+        if (const FileEntry *entry = m_src_mgr->getFileEntryForID(fid)) {
+            id = idForName(trim_filename(entry->getName().str()));
+        }
+        m_fid_ids[fid] = id;
+        return id;
+    }
+
+    unsigned idForDecl(const Decl *decl)
+    {
+        unsigned id = idForLoc(decl->getLocation());
+        if (id == InvalidID) {
+            /* For some weird reason if the declaration is
+             * behind a macro expansion sometimes it returns an
+             * empty filename above */
+            id = idForLoc(decl->getBeginLoc());
+        }
+        if (id == InvalidID) {
+            id = idForLoc(decl->getEndLoc());
+        }
+        return id;
+    }
+
+    const std::string &name(unsigned id) const
+    {
+        static const std::string empty;
+        return id == InvalidID ? empty : m_names[id];
+    }
+
+    unsigned size() const { return m_names.size(); }
+
+private:
+    SourceManager *m_src_mgr;
+    llvm::DenseMap<FileID, unsigned> m_fid_ids;
+    llvm::StringMap<unsigned> m_name_ids;
+    std::vector<std::string> m_names;
+};
+
+/* Include bookkeeping shared by the preprocessor callbacks and the AST
+ * handler, indexed by FileTable ids. */
+struct IncludeState {
+    FileTable files;
+    std::vector<int> usage_count;
+    std::vector<bool> tracked;
+    /* #included by the main file, not just used through another header */
+    std::vector<bool> direct;
+    std::vector<bool> allowed;
+    std::vector<SourceLocation> location;
+    /* is_ignored_file() per file id: 0 unknown, 1 ignored, 2 kept */
+    std::vector<char> ignored;
+
+    /* usage database only: bytes each direct include pulls into the TU
+     * and the symbols it resolved */
+    bool record_usage = false;
+    uint64_t total_bytes = 0;
+    std::vector<uint64_t> bytes;
+    std::vector<std::vector<std::string> > symbols;
+
+    explicit IncludeState(SourceManager *src_mgr) : files(src_mgr) {}
+
+    void grow(unsigned id)
+    {
+        if (id < usage_count.size()) return;
+        usage_count.resize(id + 1, 0);
+        tracked.resize(id + 1, false);
+        direct.resize(id + 1, false);
+        allowed.resize(id + 1, false);
+        location.resize(id + 1);
+        if (record_usage) {
+            bytes.resize(id + 1, 0);
+            symbols.resize(id + 1);
+        }
+    }
+
+    bool isTracked(unsigned id) const
+    {
+        return id < tracked.size() && tracked[id];
+    }
+
+    bool isIgnored(unsigned id)
+    {
+        if (id >= ignored.size()) ignored.resize(id + 1, 0);
+        if (!ignored[id]) ignored[id] = is_ignored_file(files.name(id)) ? 1 : 2;
+        return ignored[id] == 1;
+    }
+
+    void addUsage(unsigned id)
+    {
+        if (id == FileTable::InvalidID) return;
+        grow(id);
+        tracked[id] = true;
+        usage_count[id] += 1;
+    }
+};
+
+/* symbol name -> ids of the files declaring it */
+typedef llvm::StringMap<llvm::SmallVector<unsigned, 1> > DeclTable;
+
+/* On-disk cache of the declarations each user header contributes, keyed by
+ * the header's content hash (-plugin-arg-print-fnso decl-cache=<dir>).
+ * Only headers whose declarations cannot depend on the including TU are
+ * cached: entered once, with no conditional directive but an include
+ * guard, and no template or TU-created declaration (see depends_on_tu).
+ * Cached headers are not traversed again by later TUs. */
+class DeclCache {
+public:
+    enum State { UNKNOWN, UNCACHEABLE, HIT, RECORD };
+    /* one declaration-table entry: 'd'eclaration, 't'ag or 'e'xtern */
+    typedef std::pair<char, std::string> Entry;
+
+    explicit DeclCache(std::string dir) : m_dir(std::move(dir)), m_current(FileTable::InvalidID) {}
+
+    void enterFile(unsigned id, const FileEntry *entry, uint64_t hash)
+    {
+        grow(id);
+        m_files[id].entry = entry;
+        m_files[id].hash = hash;
+        m_files[id].entered++;
+    }
+
+    void addConditional(unsigned id)
+    {
+        grow(id);
+        m_files[id].conditionals++;
+    }
+
+    /* Decide which headers are served from the cache; returns the cached
+     * entries of every hit through load_entry(id, entry). */
+    template <typename Fn>
+    void resolve(HeaderSearch &header_search, Fn load_entry)
+    {
+        for (unsigned id = 0; id < m_files.size(); ++id) {
+            HeaderInfo &info = m_files[id];
+            if (info.entered != 1 || !info.entry) continue;
+            if (info.conditionals > 1) continue;
+            if (info.conditionals == 1 && !header_search.isFileMultipleIncludeGuarded(info.entry)) continue;
+            auto buffer = llvm::MemoryBuffer::getFile(path(info.hash));
+            if (!buffer) {
+                info.state = RECORD;
+                continue;
+            }
+            info.state = HIT;
+            SmallVector<StringRef, 64> lines;
+            (*buffer)->getBuffer().split(lines, '\n', -1, false);
+            for (StringRef line : lines) {
+                if (line.size() < 3 || line[1] != '\t') continue;
+                load_entry(id, Entry(line[0], line.drop_front(2).str()));
+            }
+        }
+    }
+
+    State state(unsigned id) const
+    {
+        return id < m_files.size() ? m_files[id].state : UNKNOWN;
+    }
+
+    unsigned current() const { return m_current; }
+
+    unsigned setCurrent(unsigned id)
+    {
+        unsigned prev = m_current;
+        m_current = id;
+        return prev;
+    }
+
+    void record(char tag, StringRef name, unsigned file_id)
+    {
+        if (m_current == FileTable::InvalidID) return;
+        HeaderInfo &info = m_files[m_current];
+        if (file_id != m_current) {
+            /* declared elsewhere: the header's table is not self-contained */
+            info.state = UNCACHEABLE;
+            return;
+        }
+        info.entries.push_back(Entry(tag, name.str()));
+    }
+
+    void markUncacheable(unsigned id)
+    {
+        if (id < m_files.size()) m_files[id].state = UNCACHEABLE;
+    }
+
+    void save()
+    {
+        if (sys::fs::create_directories(m_dir)) return;
+        for (const HeaderInfo &info : m_files) {
+            if (info.state != RECORD) continue;
+            std::string target = path(info.hash);
+            int fd;
+            SmallString<256> tmp_path;
+            if (sys::fs::createUniqueFile(target + "-%%%%%%.tmp", fd, tmp_path)) continue;
+            {
+                raw_fd_ostream os(fd, /*shouldClose=*/true);
+                for (const Entry &entry : info.entries) {
+                    os << entry.first << '\t' << entry.second << '\n';
+                }
+            }
+            sys::fs::rename(tmp_path, target);
+        }
     }
-    return filename;
-}
 
-class DeclCheckerHandler: public MatchFinder::MatchCallback {
 private:
-    std::map<std::string, int> *m_include_usages_count;
-    std::set<std::string> *m_includes_marked_as_allowed;
-    std::map<std::string, SourceLocation> *m_include_locations;
+    struct HeaderInfo {
+        const FileEntry *entry = nullptr;
+        uint64_t hash = 0;
+        unsigned entered = 0;
+        unsigned conditionals = 0;
+        State state = UNKNOWN;
+        std::vector<Entry> entries;
+    };
+
+    /* bumped when what gets cached changes, so stale tables are not read */
+    static constexpr const char *DECLS_SUFFIX = ".v2.decls";
+
+    void grow(unsigned id)
+    {
+        if (id >= m_files.size()) m_files.resize(id + 1);
+    }
+
+    std::string path(uint64_t hash) const
+    {
+        SmallString<256> result(m_dir);
+        sys::path::append(result, llvm::utohexstr(hash) + DECLS_SUFFIX);
+        return result.str().str();
+    }
+
+    std::string m_dir;
+    unsigned m_current;
+    std::vector<HeaderInfo> m_files;
+};
+
+/* Whole-TU result cache (-plugin-arg-print-fnso result-cache=<dir>). The
+ * key hashes the predefines and the name and contents of every file the
+ * TU entered, main file included, in order. An entry holds the plugin's
+ * diagnostics, as offsets into the main file, the summary counts and the
+ * include table; on a hit they are replayed and the AST is not walked.
+ * TUs with a plugin diagnostic outside the main file are not cached. */
+class ResultCache {
+public:
+    /* 'u'nused include, 'r'edundant allowed, missing 'w'arn_unused_result,
+     * 'l'owercase or '_' ObjC class name */
+    struct Diag {
+        char kind;
+        unsigned offset;
+        std::string arg;
+    };
+    struct Include {
+        std::string name;
+        int count;
+        uint64_t bytes;
+        std::vector<std::string> symbols;
+    };
+    static const unsigned NoOffset = ~0u;
+
+    ResultCache(std::string dir, SourceManager *src_mgr, StringRef predefines, bool record_usage)
+        : m_dir(std::move(dir)), m_src_mgr(src_mgr), m_cacheable(true)
+    {
+        m_key_data.append(predefines.data(), predefines.size());
+        m_key_data.push_back('\0');
+        m_key_data.push_back(record_usage ? 'd' : '-');
+    }
+
+    void enterFile(StringRef name, uint64_t hash)
+    {
+        m_key_data.push_back('\0');
+        m_key_data.append(name.data(), name.size());
+        m_key_data.push_back('\0');
+        m_key_data += llvm::utohexstr(hash);
+    }
+
+    /* Reads the entry for this TU; false on a miss. */
+    bool load(TUSummary &summary, std::vector<Diag> &diags, std::vector<Include> &includes)
+    {
+        auto buffer = llvm::MemoryBuffer::getFile(path());
+        if (!buffer) return false;
+        SmallVector<StringRef, 64> lines;
+        (*buffer)->getBuffer().split(lines, '\n', -1, false);
+        for (StringRef line : lines) {
+            SmallVector<StringRef, 8> fields;
+            line.split(fields, '\t');
+            if (fields[0] == "s" && fields.size() == 4) {
+                fields[1].getAsInteger(10, summary.includes);
+                fields[2].getAsInteger(10, summary.declarations);
+                fields[3].getAsInteger(10, summary.usages);
+            } else if (fields[0] == "d" && fields.size() == 4 && fields[1].size() == 1) {
+                Diag diag = { fields[1][0], NoOffset, fields[3].str() };
+                fields[2].getAsInteger(10, diag.offset);
+                diags.push_back(diag);
+            } else if (fields[0] == "i" && fields.size() >= 4) {
+                Include include = { fields[1].str(), 0, 0, {} };
+                fields[2].getAsInteger(10, include.count);
+                fields[3].getAsInteger(10, include.bytes);
+                for (unsigned i = 4; i < fields.size(); ++i) include.symbols.push_back(fields[i].str());
+                includes.push_back(include);
+            }
+        }
+        return true;
+    }
+
+    void recordDiag(char kind, SourceLocation loc, StringRef arg)
+    {
+        unsigned offset = NoOffset;
+        if (loc.isValid()) {
+            std::pair<FileID, unsigned> decomposed = m_src_mgr->getDecomposedExpansionLoc(loc);
+            if (decomposed.first != m_src_mgr->getMainFileID()) {
+                m_cacheable = false;
+                return;
+            }
+            offset = decomposed.second;
+        }
+        m_diags.push_back(Diag{ kind, offset, arg.str() });
+    }
+
+    SourceLocation location(unsigned offset) const
+    {
+        if (offset == NoOffset) return SourceLocation();
+        return m_src_mgr->getLocForStartOfFile(m_src_mgr->getMainFileID()).getLocWithOffset(offset);
+    }
+
+    void markUncacheable() { m_cacheable = false; }
+
+    void save(const TUSummary &summary, const IncludeState &state)
+    {
+        if (!m_cacheable || sys::fs::create_directories(m_dir)) return;
+        std::string target = path();
+        int fd;
+        SmallString<256> tmp_path;
+        if (sys::fs::createUniqueFile(target + "-%%%%%%.tmp", fd, tmp_path)) return;
+        {
+            raw_fd_ostream os(fd, /*shouldClose=*/true);
+            os << "s\t" << summary.includes << '\t' << summary.declarations << '\t' << summary.usages << '\n';
+            for (const Diag &diag : m_diags) {
+                os << "d\t" << diag.kind << '\t' << diag.offset << '\t' << diag.arg << '\n';
+            }
+            for (unsigned id = 0; id < state.usage_count.size(); ++id) {
+                if (!state.isTracked(id)) continue;
+                os << "i\t" << state.files.name(id) << '\t' << state.usage_count[id] << '\t'
+                   << (state.record_usage ? state.bytes[id] : 0);
+                if (state.record_usage) {
+                    for (const std::string &symbol : state.symbols[id]) os << '\t' << symbol;
+                }
+                os << '\n';
+            }
+        }
+        sys::fs::rename(tmp_path, target);
+    }
+
+private:
+    std::string path() const
+    {
+        SmallString<256> result(m_dir);
+        sys::path::append(result, llvm::utohexstr(xxHash64(m_key_data)) + ".result");
+        return result.str().str();
+    }
+
+    std::string m_dir;
+    SourceManager *m_src_mgr;
+    std::string m_key_data;
+    bool m_cacheable;
+    std::vector<Diag> m_diags;
+};
+
+class DeclCheckerHandler {
+private:
+    IncludeState *m_state;
 //    std::set<std::string> m_files_whitelist;
-    std::set<std::string> m_definitions;
-    std::set<std::string> m_usages;
-    std::map<std::string, std::deque<std::string>* > m_declarations;
-    std::set<std::string> m_tag_definitions;
-    std::map<std::string, std::deque<std::string>* > m_tag_declarations;
-    std::map<std::string, std::deque<std::string>* > m_extern_declarations;
+    llvm::StringSet<> m_definitions;
+    llvm::StringSet<> m_usages;
+    DeclTable m_declarations;
+    llvm::StringSet<> m_tag_definitions;
+    DeclTable m_tag_declarations;
+    DeclTable m_extern_declarations;
     bool m_done;
     DiagnosticsEngine *m_diag;
     ASTContext *m_context;
+    LangOptions m_lang_opts;
+    PrintingPolicy m_policy;
+    TUSummary m_summary;
+    DeclCache *m_decl_cache;
+    ResultCache *m_result_cache;
     
 public:
-    DeclCheckerHandler(std::map<std::string, int> *include_usages_count,
-                        std::set<std::string> *includes_marked_as_allowed,
-                        std::map<std::string, SourceLocation> *include_locations)
-    {
-        m_done = false;
-        m_include_usages_count = include_usages_count;
-        m_includes_marked_as_allowed = includes_marked_as_allowed;
-        m_include_locations = include_locations;
+    DeclCheckerHandler(IncludeState *state)
+        : m_state(state), m_done(false), m_diag(nullptr), m_context(nullptr),
+          m_policy(m_lang_opts), m_decl_cache(nullptr), m_result_cache(nullptr)
+    {
 //        m_files_whitelist = *files_whitelist;
     }
     
-    void handle_source_location(std::string filename)
+    void handle_source_location(unsigned file_id)
     {
-        llvm::errs() << "Found usage of: " << filename << " \n";
-        if (m_include_usages_count->count(filename) == 0) {
-            (*m_include_usages_count)[filename] = 1;
-        } else {
-            (*m_include_usages_count)[filename] += 1;
-        }
+        IC_LOG(LOG_TRACE, "Found usage of: " << m_state->files.name(file_id) << " \n");
+        m_state->addUsage(file_id);
+    }
+
+    const TUSummary &summary() const { return m_summary; }
+
+    void setDeclCache(DeclCache *cache) { m_decl_cache = cache; }
+
+    void setResultCache(ResultCache *cache) { m_result_cache = cache; }
+
+    void record_diag(char kind, SourceLocation loc, StringRef arg)
+    {
+        if (m_result_cache) m_result_cache->recordDiag(kind, loc, arg);
     }
 
-    static void handle_declaration(std::map<std::string, std::deque<std::string>* > *ns,
-                                   std::string name, std::string filename)
+    void handle_declaration(DeclTable *ns, StringRef name, unsigned file_id)
     {
-        if (ns->count(name) == 0) {
-            (*ns)[name] = new std::deque<std::string>();
+        m_summary.declarations++;
+        (*ns)[name].push_back(file_id);
+        if (m_decl_cache) {
+            char tag = ns == &m_tag_declarations ? 't' : ns == &m_extern_declarations ? 'e' : 'd';
+            m_decl_cache->record(tag, name, file_id);
         }
-        (*ns)[name]->push_back(filename);
+    }
+
+    void handle_cached_declaration(unsigned file_id, const DeclCache::Entry &entry)
+    {
+        DeclTable *ns = entry.first == 't' ? &m_tag_declarations
+                      : entry.first == 'e' ? &m_extern_declarations
+                      : &m_declarations;
+        handle_declaration(ns, entry.second, file_id);
     }
 
     void handle_tag_usage(ASTContext *context, const TagDecl *tag_decl)
@@ -176,208 +607,237 @@ public:
         const std::string name = tag_decl->getTypeForDecl()->getCanonicalTypeInternal().getUnqualifiedType().getAsString(); // tag_decl->getNameAsString();
         SourceLocation loc = tag_decl->getLocation();
         if (loc.isValid()) {
-            std::string filename = get_filename(&context->getSourceManager(), loc);
-            llvm::errs() << "Found type usage: " << name << " from " << filename << " \n";
+            IC_LOG(LOG_TRACE, "Found type usage: " << name << " from " << m_state->files.name(m_state->files.idForLoc(loc)) << " \n");
             m_tag_definitions.insert(name);
         }
     }
     
-    void run(const MatchFinder::MatchResult &Result) override {
-        if (!m_diag) {
-            m_context = Result.Context;
-            DiagnosticsEngine &diagEngine = m_context->getDiagnostics();
-            m_diag = &diagEngine;
-        }
-        {
-            const ObjCInterfaceDecl *decl = Result.Nodes.getNodeAs<ObjCInterfaceDecl>(StringRef("ObjCInterfaceDecl"));
-            if (decl) {
-                checkForLowercasedName(const_cast<ObjCInterfaceDecl*>(decl));
-                checkForUnderscoreInName(const_cast<ObjCInterfaceDecl*>(decl));
-            }
-        }
-        {
-            const FunctionDecl *func = Result.Nodes.getNodeAs<FunctionDecl>("badFunc");
-            if (func) {
-                unsigned diagID = m_diag->getCustomDiagID(DiagnosticsEngine::Warning, "missing attribute warn_unused_result");
-                m_diag->Report(func->getLocation(), diagID);
+    void setContext(ASTContext *context)
+    {
+        m_context = context;
+        m_diag = &context->getDiagnostics();
+    }
+
+    void handle_objc_interface(ObjCInterfaceDecl *decl)
+    {
+        checkForLowercasedName(decl->getName(), decl->getLocation());
+        checkForUnderscoreInName(decl->getName(), decl->getLocation());
+    }
+
+    void handle_missing_warn_unused_result(SourceLocation loc)
+    {
+        unsigned diagID = m_diag->getCustomDiagID(DiagnosticsEngine::Warning, "missing attribute warn_unused_result");
+        m_diag->Report(loc, diagID);
+        record_diag('w', loc, "");
+    }
+
+    /* Reissues the diagnostics and summary of a result cache hit. */
+    void replay(const ResultCache &cache, const TUSummary &counts,
+                const std::vector<ResultCache::Diag> &diags)
+    {
+        m_done = true;
+        m_summary.includes = counts.includes;
+        m_summary.declarations = counts.declarations;
+        m_summary.usages = counts.usages;
+        for (const ResultCache::Diag &diag : diags) {
+            SourceLocation loc = cache.location(diag.offset);
+            switch (diag.kind) {
+            case 'u':
+                emit_unused_include_warn(*m_diag, loc, diag.arg);
+                m_summary.unused.push_back(diag.arg);
+                break;
+            case 'r':
+                emit_redundant_allowed_warn(*m_diag, loc, diag.arg);
+                m_summary.redundant_allowed.push_back(diag.arg);
+                break;
+            case 'w':
+                handle_missing_warn_unused_result(loc);
+                break;
+            case 'l':
+                checkForLowercasedName(diag.arg, loc);
+                break;
+            case '_':
+                checkForUnderscoreInName(diag.arg, loc);
+                break;
             }
         }
-        
-        {
-            const MemberExpr *expr = Result.Nodes.getNodeAs<MemberExpr>("memberExpr");
-            if (expr) {
-                const FieldDecl *member_decl = dyn_cast<FieldDecl>(expr->getMemberDecl());
-                const RecordDecl *parent_decl = member_decl->getParent();
-                const clang::Type *type = parent_decl->getTypeForDecl();
-
-                LangOptions *lo = new LangOptions();
-                PrintingPolicy policy((const LangOptions&)lo);
-                const std::string name = QualType::getAsString(type, Qualifiers(), policy);
-                llvm::errs() << "Type Usage via member access: " << name << " \n";
-                m_tag_definitions.insert(name);
-            }
+    }
+
+    void handle_member_expr(const MemberExpr *expr)
+    {
+        const FieldDecl *member_decl = dyn_cast<FieldDecl>(expr->getMemberDecl());
+        if (!member_decl) return;
+        const RecordDecl *parent_decl = member_decl->getParent();
+        const clang::Type *type = parent_decl->getTypeForDecl();
+
+        const std::string name = QualType::getAsString(type, Qualifiers(), m_policy);
+        IC_LOG(LOG_TRACE, "Type Usage via member access: " << name << " \n");
+        m_tag_definitions.insert(name);
+    }
+
+    void handle_decl_ref(const DeclRefExpr *expr)
+    {
+        const ValueDecl *value_decl = expr->getDecl();
+        if (value_decl->getLocation().isValid()) {
+            const std::string name = expr->getNameInfo().getAsString();
+            IC_LOG(LOG_TRACE, "Usage: " << name << " \n");
+            m_usages.insert(name);
         }
-        {
-            const DeclRefExpr *expr = Result.Nodes.getNodeAs<DeclRefExpr>("declRef");
-            if (expr) {
-                const ValueDecl *value_decl = expr->getDecl();
-                if (value_decl->getLocation().isValid()) {
-                    const std::string name = expr->getNameInfo().getAsString();
-                    llvm::errs() << "Usage: " << name << " \n";
-                    m_usages.insert(name);
-                }
+    }
+
+    void handle_definition(const ValueDecl *decl)
+    {
+        const std::string name = decl->getNameAsString();
+        IC_LOG(LOG_TRACE, "Definition: " << name << " \n");
+        m_definitions.insert(name);
+    }
+
+    void handle_other_declaration(const NamedDecl *decl)
+    {
+        if (!decl->getLocation().isValid()) return;
+        unsigned file_id = m_state->files.idForDecl(decl);
+        const std::string &filename = m_state->files.name(file_id);
+        const TypedefNameDecl *_typedef = dyn_cast<TypedefNameDecl>(decl);
+        const TypeDecl *typeDecl = dyn_cast<TypeDecl>(decl);
+        const VarDecl *as_var = dyn_cast<VarDecl>(decl);
+        const FunctionDecl *as_func = dyn_cast<FunctionDecl>(decl);
+        const EnumConstantDecl *as_enum_const = dyn_cast<EnumConstantDecl>(decl);
+        if (_typedef) {
+            const std::string name = _typedef->getNameAsString();
+            IC_LOG(LOG_TRACE, "Typedef Declaration: " << name << " in " << filename << " \n");
+            handle_declaration(&m_tag_declarations, name, file_id);
+        } else if (typeDecl) {
+            const clang::Type *type = typeDecl->getTypeForDecl();
+            
+            const std::string name = QualType::getAsString(type, Qualifiers(), m_policy);
+            IC_LOG(LOG_TRACE, "Type Declaration: " << name << " in " << filename << " \n");
+            handle_declaration(&m_tag_declarations, name, file_id);
+        } else if (as_var) {
+            const std::string name = decl->getNameAsString();
+            if (as_var->hasExternalStorage()) {
+                IC_LOG(LOG_TRACE, "Var Declaration (extern): " << name << " \n");
+                handle_declaration(&m_extern_declarations, name, file_id);
             }
+            IC_LOG(LOG_TRACE, "Var declaration: " << name << " \n");
+            handle_declaration(&m_declarations, name, file_id);
+        } else if (as_func) {
+            const std::string name = decl->getNameAsString();
+            // TODO: Add to extern_decl only if the function is extern.
+            // Currently this is disabled because we have sometimes:
+            // foo_internal.h
+            // foo.h
+            // foo.c -> defines some things from foo_internal.h
+            // if (as_func->getStorageClass() == clang::StorageClass::SC_Extern) {
+            //     ON_DEBUG(std::cerr << "Func Declaration (extern): " << name << std::endl);
+            handle_declaration(&m_extern_declarations, name, file_id);
+            // }
+            IC_LOG(LOG_TRACE, "Func Declaration: " << name << " \n");
+            handle_declaration(&m_declarations, name, file_id);
+        } else if (as_enum_const) {
+            const std::string name = decl->getNameAsString();
+            IC_LOG(LOG_TRACE, "Enum Declaration: " << name << " \n");
+            handle_declaration(&m_declarations, name, file_id);
         }
-        {
-            const ValueDecl *decl = Result.Nodes.getNodeAs<ValueDecl>("decl");
-            if (decl) {
-                const std::string name = decl->getNameAsString();
-                llvm::errs() << "Definition: " << name << " \n";
-                m_definitions.insert(name);
-                return;
-            }
+    }
+
+    void handle_type_loc(TypeLoc type_loc)
+    {
+        const clang::Type *type = type_loc.getTypePtr();
+        const TagDecl *tag_decl = type->getAsTagDecl();
+        if (tag_decl) {
+            handle_tag_usage(m_context, tag_decl);
         }
-        {
-            const NamedDecl *decl = Result.Nodes.getNodeAs<NamedDecl>("declOther");
-            if (decl) {
-                if (decl->getLocation().isValid()) {
-                    std::string filename = getFilenameFromDecl(&m_context->getSourceManager(), decl);
-                    const TypedefNameDecl *_typedef = dyn_cast<TypedefNameDecl>(decl);
-                    const TypeDecl *typeDecl = dyn_cast<TypeDecl>(decl);
-                    const VarDecl *as_var = dyn_cast<VarDecl>(decl);
-                    const FunctionDecl *as_func = dyn_cast<FunctionDecl>(decl);
-                    const EnumConstantDecl *as_enum_const = dyn_cast<EnumConstantDecl>(decl);
-                    if (_typedef) {
-                        const std::string name = _typedef->getNameAsString();
-                        llvm::errs() << "Typedef Declaration: " << name << " in " << filename << " \n";
-                        handle_declaration(&m_tag_declarations, name, filename);
-                    } else if (typeDecl) {
-                        const clang::Type *type = typeDecl->getTypeForDecl();
-                        
-                        LangOptions *lo = new LangOptions();
-                        PrintingPolicy policy((const LangOptions&)lo);
-                        const std::string name = QualType::getAsString(type, Qualifiers(), policy);
-                        llvm::errs() << "Type Declaration: " << name << " in " << filename << " \n";
-                        handle_declaration(&m_tag_declarations, name, filename);
-                    } else if (as_var) {
-                        const std::string name = decl->getNameAsString();
-                        if (as_var->hasExternalStorage()) {
-                            llvm::errs() << "Var Declaration (extern): " << name << " \n";
-                            handle_declaration(&m_extern_declarations, name, filename);
-                        }
-                        llvm::errs() << "Var declaration: " << name << " \n";
-                        handle_declaration(&m_declarations, name, filename);
-                    } else if (as_func) {
-                        const std::string name = decl->getNameAsString();
-                        // TODO: Add to extern_decl only if the function is extern.
-                        // Currently this is disabled because we have sometimes:
-                        // foo_internal.h
-                        // foo.h
-                        // foo.c -> defines some things from foo_internal.h
-                        // if (as_func->getStorageClass() == clang::StorageClass::SC_Extern) {
-                        //     ON_DEBUG(std::cerr << "Func Declaration (extern): " << name << std::endl);
-                        handle_declaration(&m_extern_declarations, name, filename);
-                        // }
-                        llvm::errs() << "Func Declaration: " << name << " \n";
-                        handle_declaration(&m_declarations, name, filename);
-                    } else if (as_enum_const) {
-                        const std::string name = decl->getNameAsString();
-                        llvm::errs() << "Enum Declaration: " << name << " \n";
-                        handle_declaration(&m_declarations, name, filename);
-                    }
-                    return;
-                }
+        const TypedefType *typedef_type = type->getAs<TypedefType>();
+        if (typedef_type) {
+            const TypedefNameDecl *_typedef = typedef_type->getDecl();
+            const std::string name = _typedef->getNameAsString();
+            SourceLocation loc = _typedef->getLocation();
+            if (loc.isValid()) {
+                IC_LOG(LOG_TRACE, "Found Typedef usage: " << name << " from " << m_state->files.name(m_state->files.idForLoc(loc)) << " \n");
+                m_tag_definitions.insert(name);
             }
-        }
-        {
-            const TypeLoc *type_loc = Result.Nodes.getNodeAs<TypeLoc>("typeLoc");
-            if (type_loc) {
-                const clang::Type *type = type_loc->getTypePtr();
-                const TagDecl *tag_decl = type->getAsTagDecl();
-                if (tag_decl) {
-                    handle_tag_usage(m_context, tag_decl);
-                }
-                const TypedefType *typedef_type = type->getAs<TypedefType>();
-                if (typedef_type) {
-                    const TypedefNameDecl *_typedef = typedef_type->getDecl();
-                    const std::string name = _typedef->getNameAsString();
-                    SourceLocation loc = _typedef->getLocation();
-                    if (loc.isValid()) {
-                        std::string filename = get_filename(&m_context->getSourceManager(), loc);
-                        llvm::errs() << "Found Typedef usage: " << name << " from " << filename << " \n";
-                        m_tag_definitions.insert(name);
-                    }
-                    const TagDecl *other_tag_decl = _typedef->getAnonDeclWithTypedefName(true);
-                    if (other_tag_decl) {
-                        handle_tag_usage(m_context, other_tag_decl);
-                    }
-                }
+            const TagDecl *other_tag_decl = _typedef->getAnonDeclWithTypedefName(true);
+            if (other_tag_decl) {
+                handle_tag_usage(m_context, other_tag_decl);
             }
         }
     }
     
-    void process_deps(
-        std::set<std::string> definitions,
-        std::map<std::string, std::deque<std::string>* > declarations)
-    {
-        for (auto it : definitions) {
-            if (declarations.count(it) > 0) {
-                llvm::errs() << "Found " << it << " \n";
-                for (auto pos_it : *declarations[it]) {
-                    handle_source_location(pos_it);
+    void process_deps(const llvm::StringSet<> &definitions, const DeclTable &declarations)
+    {
+        for (const auto &it : definitions) {
+            auto found = declarations.find(it.getKey());
+            if (found == declarations.end()) continue;
+            IC_LOG(LOG_DEBUG, "Found " << it.getKey() << " \n");
+            for (unsigned file_id : found->getValue()) {
+                handle_source_location(file_id);
+                if (m_state->record_usage && file_id != FileTable::InvalidID) {
+                    std::vector<std::string> &symbols = m_state->symbols[file_id];
+                    if (symbols.empty() || symbols.back() != it.getKey()) {
+                        symbols.push_back(it.getKey().str());
+                    }
                 }
             }
         }
     }
 
-    void onEndOfTranslationUnit() override {
+    void onEndOfTranslationUnit() {
         /* this funciton may be run several times */
         if (m_done) return;
         m_done = true;
         process_deps(m_usages, m_declarations);
         process_deps(m_definitions, m_extern_declarations);
         process_deps(m_tag_definitions, m_tag_declarations);
+        m_summary.usages = m_usages.size() + m_definitions.size() + m_tag_definitions.size();
+
+        FileTable &files = m_state->files;
 
         // if a _private.h was used, allow include the _api.h
-        std::vector<std::string> apis_allowed_because_of_privates;
-        for (auto it : *m_include_usages_count) {
-            auto filename = it.first;
-            auto trimmed = trim_suffix(filename, "_private.h");
-            if (!trimmed.hasValue()) continue;
-            if (m_include_usages_count->count(filename) == 0) continue;
-            if ((*m_include_usages_count)[filename] == 0) continue;
-            apis_allowed_because_of_privates.push_back(trimmed.getValue() + "_api.h");
-        }
-        for (auto api : apis_allowed_because_of_privates) {
-            if (m_include_usages_count->count(api) == 0) {
-                (*m_include_usages_count)[api] = 1;
-            } else {
-                (*m_include_usages_count)[api] += 1;
-            }
+        std::vector<unsigned> apis_allowed_because_of_privates;
+        const StringRef private_suffix = "_private.h";
+        for (unsigned id = 0; id < m_state->usage_count.size(); ++id) {
+            if (!m_state->isTracked(id) || m_state->usage_count[id] == 0) continue;
+            StringRef filename = files.name(id);
+            if (!filename.endswith(private_suffix)) continue;
+            apis_allowed_because_of_privates.push_back(
+                files.idForName((filename.drop_back(private_suffix.size()) + "_api.h").str()));
+        }
+        for (unsigned api : apis_allowed_because_of_privates) {
+            m_state->addUsage(api);
         }
 
-        // verify no unused includes left
-        for (auto it : *m_include_usages_count) {
-            auto filename = it.first;
-            auto count = it.second;
-            const bool marked_as_allowed =
-                m_includes_marked_as_allowed->end() != m_includes_marked_as_allowed->find(filename);
+        // verify no unused includes left, reported in filename order
+        std::vector<unsigned> tracked_ids;
+        for (unsigned id = 0; id < m_state->usage_count.size(); ++id) {
+            if (m_state->isTracked(id)) tracked_ids.push_back(id);
+        }
+        std::sort(tracked_ids.begin(), tracked_ids.end(), [&files](unsigned a, unsigned b) {
+            return files.name(a) < files.name(b);
+        });
+        m_summary.includes = tracked_ids.size();
+        for (unsigned id : tracked_ids) {
+            const std::string &filename = files.name(id);
+            int count = m_state->usage_count[id];
+            const bool marked_as_allowed = m_state->allowed[id];
             if (count == 0) {
                 if (marked_as_allowed) continue;
 //                if (m_files_whitelist.count(filename) > 0) continue;
-                emit_unused_include_warn(*m_diag, (*m_include_locations)[filename], filename);
+                emit_unused_include_warn(*m_diag, m_state->location[id], filename);
+                record_diag('u', m_state->location[id], filename);
+                m_summary.unused.push_back(filename);
             } else {
                 if (marked_as_allowed) {
-                    emit_redundant_allowed_warn(*m_diag, (*m_include_locations)[filename], filename);
+                    emit_redundant_allowed_warn(*m_diag, m_state->location[id], filename);
+                    record_diag('r', m_state->location[id], filename);
+                    m_summary.redundant_allowed.push_back(filename);
                 }
             }
-            llvm::errs() << filename << " => " << count << " \n";
+            IC_LOG(LOG_DEBUG, filename << " => " << count << " \n");
         }
     }
     
-    void checkForUnderscoreInName(ObjCInterfaceDecl *declaration)
+    void checkForUnderscoreInName(StringRef name, SourceLocation nameStart)
     {
-        StringRef name = declaration->getName();
         size_t underscorePos = name.find('_');
         if (underscorePos != StringRef::npos) {
            std::string tempName = name.str();
@@ -385,38 +845,36 @@ public:
            tempName.erase(end_pos, tempName.end());
            StringRef replacement(tempName);
 
-           llvm::errs() << "replacement: \"" << replacement << "\"\n";
+           IC_LOG(LOG_DEBUG, "replacement: \"" << replacement << "\"\n");
 
-           SourceLocation nameStart = declaration->getLocation();
            SourceLocation nameEnd = nameStart.getLocWithOffset(name.size());
 
            FixItHint fixItHint = FixItHint::CreateReplacement(SourceRange(nameStart, nameEnd), replacement);
 
            DiagnosticsEngine &diagEngine = m_context->getDiagnostics();
            unsigned diagID = diagEngine.getCustomDiagID(DiagnosticsEngine::Error, "Class name with `_` forbidden");
-           SourceLocation location = declaration->getLocation().getLocWithOffset(underscorePos);
+           SourceLocation location = nameStart.getLocWithOffset(underscorePos);
            diagEngine.Report(location, diagID).AddFixItHint(fixItHint);
+           record_diag('_', nameStart, name);
         }
     }
 
-    void checkForLowercasedName(ObjCInterfaceDecl *declaration)
+    void checkForLowercasedName(StringRef name, SourceLocation nameStart)
     {
-       StringRef name = declaration->getName();
        char c = name[0];
        if (isLowercase(c)) {
            std::string tempName = name.str();
            tempName[0] = toUppercase(c);
            StringRef replacement(tempName);
 
-           SourceLocation nameStart = declaration->getLocation();
            SourceLocation nameEnd = nameStart.getLocWithOffset(name.size());
 
            FixItHint fixItHint = FixItHint::CreateReplacement(SourceRange(nameStart, nameEnd), replacement);
 
            DiagnosticsEngine &diagEngine = m_context->getDiagnostics();
            unsigned diagID = diagEngine.getCustomDiagID(DiagnosticsEngine::Warning, "Class name should not start with lowercase letter");
-           SourceLocation location = declaration->getLocation();
-           diagEngine.Report(location, diagID).AddFixItHint(fixItHint);
+           diagEngine.Report(nameStart, diagID).AddFixItHint(fixItHint);
+           record_diag('l', nameStart, name);
        }
     }
 };
@@ -424,23 +882,22 @@ public:
 class Find_Includes : public PPCallbacks
 {
 private:
-    std::map<std::string, int> *m_include_usages_count;
-    std::map<std::string, SourceLocation> *m_include_locations;
-    std::set<std::string> *m_includes_marked_as_allowed;
+    IncludeState *m_state;
     std::string m_main_filename;
     SourceManager *m_src_mgr;
+    /* usage database only: the direct include each entered file came through */
+    llvm::DenseMap<FileID, unsigned> m_top_include;
+    DeclCache *m_decl_cache;
+    ResultCache *m_result_cache;
 
 public:
-    Find_Includes(
-        SourceManager *src_mgr,
-        std::map<std::string, int> *include_usages_count,
-        std::set<std::string> *includes_marked_as_allowed,
-        std::map<std::string, SourceLocation> *include_locations)
+    Find_Includes(SourceManager *src_mgr, IncludeState *state, DeclCache *decl_cache,
+                  ResultCache *result_cache)
     {
         m_src_mgr = src_mgr;
-        m_include_usages_count = include_usages_count;
-        m_includes_marked_as_allowed = includes_marked_as_allowed;
-        m_include_locations = include_locations;
+        m_state = state;
+        m_decl_cache = decl_cache;
+        m_result_cache = result_cache;
         m_main_filename = src_mgr->getFileEntryForID(src_mgr->getMainFileID())->getName().str();
         auto trimmed = trim_suffix(m_main_filename, ".c");
         if (trimmed.hasValue()) {
@@ -451,30 +908,19 @@ public:
 
     void MarkFileUsed(std::string name)
     {
-        if (m_include_usages_count->count(name) == 0) {
-            (*m_include_usages_count)[name] = 1;
-        }
-    }
-
-    bool isIgnoredFile(std::string name)
-    {
-        std::string ignored_prefix = "/usr/";
-        if (name.compare(0, ignored_prefix.length(), ignored_prefix) == 0) return true; // /usr/ ignore
-        std::string allowed_suffix = ".h";
-        if (name.length() >= allowed_suffix.length()) {
-            if (0 != name.compare(name.length() - allowed_suffix.length(), allowed_suffix.length(), allowed_suffix)) return true; // .h not ignore
+        unsigned id = m_state->files.idForName(name);
+        if (!m_state->isTracked(id)) {
+            m_state->addUsage(id);
         }
-        return false;
     }
 
-
     bool hasIncludeComment(CharSourceRange filename_range, SourceManager &sm, std::string expected)
     {
         const CharSourceRange range = CharSourceRange::getCharRange(
                                         filename_range.getEnd(),
                                         filename_range.getEnd().getLocWithOffset(expected.size()));
-        std::string txt = Lexer::getSourceText(range, sm, LangOptions()).str();
-        llvm::errs() << "Include line text: " << txt << " \n";
+        StringRef txt = Lexer::getSourceText(range, sm, LangOptions());
+        IC_LOG(LOG_TRACE, "Include line text: " << txt << " \n");
         return txt == expected;
     }
 
@@ -489,95 +935,422 @@ public:
         StringRef relative_path,
         const clang::Module *imported,
         SrcMgr::CharacteristicKind FileType
-    ) {
+    ) override {
         // do something with the include
         if (!hash_loc.isValid()) return;
         if (!file) return; // happens if file was not found (wrong #include)
         if (!m_src_mgr->isInMainFile(hash_loc)) return;
-        std::string name = trim_filename(file->getName().str());
-        llvm::errs() << name << " \n";
-        if (m_include_usages_count->count(name) > 0) return;
-        if (isIgnoredFile(name)) return;
+        unsigned id = m_state->files.idForName(trim_filename(file->getName().str()));
+        const std::string &name = m_state->files.name(id);
+        IC_LOG(LOG_DEBUG, name << " \n");
+        if (m_state->isIgnored(id)) return;
+        m_state->grow(id);
+        m_state->direct[id] = true;
+        if (m_state->isTracked(id)) return;
+        m_state->tracked[id] = true;
         if (hasIncludeComment(filename_range, *m_src_mgr, " /* include:allowed */")) {
-            (*m_includes_marked_as_allowed).insert(name);
+            m_state->allowed[id] = true;
         }
-        (*m_include_usages_count)[name]
+        m_state->usage_count[id]
             = (hasIncludeComment(filename_range, *m_src_mgr, " /* include:optional */"))
             ? 1
             : 0;
-        (*m_include_locations)[name] = hash_loc;
+        m_state->location[id] = hash_loc;
     }
     
+    void FileChanged(SourceLocation loc, FileChangeReason reason,
+                     SrcMgr::CharacteristicKind file_type, FileID prev_fid) override
+    {
+        if (reason != EnterFile) return;
+        if (!m_state->record_usage && !m_decl_cache && !m_result_cache) return;
+        FileID fid = m_src_mgr->getFileID(loc);
+        const FileEntry *entry = m_src_mgr->getFileEntryForID(fid);
+        if (!entry) return;
+        if (m_result_cache) {
+            /* every entered file, system headers included: any of them can
+             * change what the main file resolves to */
+            m_result_cache->enterFile(entry->getName(), xxHash64(m_src_mgr->getBufferData(fid)));
+        }
+        if (m_decl_cache && fid != m_src_mgr->getMainFileID()) {
+            unsigned id = m_state->files.idForLoc(loc);
+            if (id != FileTable::InvalidID && !m_state->isIgnored(id)) {
+                m_decl_cache->enterFile(id, entry, xxHash64(m_src_mgr->getBufferData(fid)));
+            }
+        }
+        if (!m_state->record_usage) return;
+        m_state->total_bytes += entry->getSize();
+        SourceLocation include_loc = m_src_mgr->getIncludeLoc(fid);
+        if (!include_loc.isValid()) return; // the main file itself
+        FileID parent = m_src_mgr->getFileID(include_loc);
+        unsigned top;
+        if (parent == m_src_mgr->getMainFileID()) {
+            top = m_state->files.idForLoc(loc);
+        } else {
+            auto it = m_top_include.find(parent);
+            if (it == m_top_include.end()) return;
+            top = it->second;
+        }
+        if (top == FileTable::InvalidID) return;
+        m_top_include[fid] = top;
+        m_state->grow(top);
+        m_state->bytes[top] += entry->getSize();
+    }
+
+    void addConditional(SourceLocation loc)
+    {
+        if (!m_decl_cache || m_src_mgr->isInMainFile(loc)) return;
+        unsigned id = m_state->files.idForLoc(loc);
+        if (id != FileTable::InvalidID) m_decl_cache->addConditional(id);
+    }
+
+    void If(SourceLocation loc, SourceRange condition_range, ConditionValueKind value) override
+    {
+        addConditional(loc);
+    }
+
+    void Ifdef(SourceLocation loc, const Token &macro_name, const MacroDefinition &md) override
+    {
+        addConditional(loc);
+    }
+
+    void Ifndef(SourceLocation loc, const Token &macro_name, const MacroDefinition &md) override
+    {
+        addConditional(loc);
+    }
+
     void MacroExpands(const Token &MacroNameTok,
         const MacroDefinition &MD, SourceRange Range,
-        const MacroArgs *Args)
+        const MacroArgs *Args) override
     {
-        MacroInfo *macro_info = MD.getMacroInfo();
-        SourceLocation macro_def_loc = macro_info->getDefinitionLoc();
         SourceLocation use_loc = Range.getBegin();
-        std::string filename = get_filename(m_src_mgr, macro_def_loc);
-        std::string use_filename = get_filename(m_src_mgr, use_loc);
         if (!use_loc.isValid()) return;
         if (!m_src_mgr->isInMainFile(use_loc)) return;
-        if (isIgnoredFile(filename)) return;
-        if (m_include_usages_count->count(filename) == 0) {
-            (*m_include_usages_count)[filename] = 1;
-        } else {
-            (*m_include_usages_count)[filename] += 1;
+        MacroInfo *macro_info = MD.getMacroInfo();
+        unsigned id = m_state->files.idForLoc(macro_info->getDefinitionLoc());
+        if (id == FileTable::InvalidID) return;
+        if (m_state->isIgnored(id)) return;
+        m_state->addUsage(id);
+        m_state->location[id] = use_loc;
+    }
+};
+
+/* Declarations a header gets from the TU including it: template
+ * instantiations and the implicit members Sema declares on demand. A
+ * template may be instantiated differently by the next TU, so a header
+ * declaring one is not cacheable either. */
+static bool depends_on_tu(const Decl *decl)
+{
+    if (isa<TemplateDecl>(decl)) return true;
+    if (const CXXRecordDecl *record = dyn_cast<CXXRecordDecl>(decl)) {
+        if (record->isInjectedClassName()) return false;
+    }
+    if (decl->isImplicit()) return true;
+    if (const ClassTemplateSpecializationDecl *spec = dyn_cast<ClassTemplateSpecializationDecl>(decl)) {
+        return spec->getSpecializationKind() != TSK_ExplicitSpecialization;
+    }
+    if (const FunctionDecl *func = dyn_cast<FunctionDecl>(decl)) {
+        return func->getTemplateSpecializationKind() == TSK_ImplicitInstantiation;
+    }
+    if (const VarDecl *var = dyn_cast<VarDecl>(decl)) {
+        return var->getTemplateSpecializationKind() == TSK_ImplicitInstantiation;
+    }
+    return false;
+}
+
+/* Collects usages, declarations and type references for the include
+ * cleaner in a single walk over the AST. Declarations from ignored files
+ * (system headers, non-.h files) are skipped together with their subtrees. */
+class IncludeUsageVisitor : public RecursiveASTVisitor<IncludeUsageVisitor> {
+private:
+    DeclCheckerHandler *m_handler;
+    IncludeState *m_state;
+    DeclCache *m_decl_cache;
+    SourceManager &m_src_mgr;
+
+public:
+    IncludeUsageVisitor(DeclCheckerHandler *handler, IncludeState *state,
+                        DeclCache *decl_cache, SourceManager &src_mgr)
+        : m_handler(handler), m_state(state), m_decl_cache(decl_cache), m_src_mgr(src_mgr) {}
+
+    bool shouldVisitTemplateInstantiations() const { return true; }
+    bool shouldVisitImplicitCode() const { return true; }
+
+    bool isExpansionInMainFile(SourceLocation loc) const
+    {
+        if (!loc.isValid()) return false;
+        return m_src_mgr.isInMainFile(m_src_mgr.getExpansionLoc(loc));
+    }
+
+    /* id of the header a declaration expands in, InvalidID for the main file */
+    unsigned headerOf(const Decl *decl)
+    {
+        SourceLocation loc = decl->getBeginLoc();
+        if (!loc.isValid()) return FileTable::InvalidID;
+        loc = m_src_mgr.getExpansionLoc(loc);
+        if (m_src_mgr.isInMainFile(loc)) return FileTable::InvalidID;
+        return m_state->files.idForLoc(loc);
+    }
+
+    bool TraverseDecl(Decl *decl)
+    {
+        if (!decl) return true;
+        unsigned id = headerOf(decl);
+        if (id == FileTable::InvalidID) return RecursiveASTVisitor<IncludeUsageVisitor>::TraverseDecl(decl);
+        if (m_state->isIgnored(id)) return true;
+        if (m_decl_cache) {
+            unsigned current = m_decl_cache->current();
+            if (current != FileTable::InvalidID) {
+                if (id != current || depends_on_tu(decl)) m_decl_cache->markUncacheable(current);
+            } else if (m_decl_cache->state(id) == DeclCache::HIT) {
+                if (ObjCInterfaceDecl *iface = dyn_cast<ObjCInterfaceDecl>(decl)) {
+                    m_handler->handle_objc_interface(iface);
+                }
+                return true;
+            } else if (m_decl_cache->state(id) == DeclCache::RECORD) {
+                if (depends_on_tu(decl)) m_decl_cache->markUncacheable(id);
+                m_decl_cache->setCurrent(id);
+                bool result = RecursiveASTVisitor<IncludeUsageVisitor>::TraverseDecl(decl);
+                m_decl_cache->setCurrent(FileTable::InvalidID);
+                return result;
+            }
+        }
+        return RecursiveASTVisitor<IncludeUsageVisitor>::TraverseDecl(decl);
+    }
+
+    bool VisitNamedDecl(NamedDecl *decl)
+    {
+        if (!isExpansionInMainFile(decl->getBeginLoc())) {
+            m_handler->handle_other_declaration(decl);
+        }
+        return true;
+    }
+
+    bool VisitValueDecl(ValueDecl *decl)
+    {
+        if (!isExpansionInMainFile(decl->getBeginLoc())) return true;
+        const DeclContext *ctx = decl->getDeclContext();
+        if (ctx && !isExpansionInMainFile(Decl::castFromDeclContext(ctx)->getBeginLoc())) {
+            m_handler->handle_definition(decl);
+        }
+        return true;
+    }
+
+    bool VisitFunctionDecl(FunctionDecl *func)
+    {
+        if (!isExpansionInMainFile(func->getBeginLoc())) return true;
+        if (func->isImplicit()) return true;
+        if (func->getDeclName().isIdentifier() && func->getName() == "main") return true;
+        if (func->getReturnType().getAsString() == "void") return true;
+        if (func->hasAttr<WarnUnusedResultAttr>()) return true;
+        m_handler->handle_missing_warn_unused_result(func->getLocation()); // 未使用的 C 函数
+        return true;
+    }
+
+    bool VisitObjCInterfaceDecl(ObjCInterfaceDecl *decl)
+    {
+        m_handler->handle_objc_interface(decl); // 类名大小写
+        return true;
+    }
+
+    // 查询无效 include 文件
+    bool VisitMemberExpr(MemberExpr *expr)
+    {
+        if (isExpansionInMainFile(expr->getBeginLoc())) {
+            m_handler->handle_member_expr(expr);
+        }
+        return true;
+    }
+
+    bool VisitDeclRefExpr(DeclRefExpr *expr)
+    {
+        if (isExpansionInMainFile(expr->getBeginLoc())
+            && !isExpansionInMainFile(expr->getDecl()->getBeginLoc())) {
+            m_handler->handle_decl_ref(expr);
+        }
+        return true;
+    }
+
+    bool VisitTypeLoc(TypeLoc type_loc)
+    {
+        if (isExpansionInMainFile(type_loc.getBeginLoc())) {
+            m_handler->handle_type_loc(type_loc);
         }
-        (*m_include_locations)[filename] = use_loc;
+        return true;
     }
 };
 
-StatementMatcher memberExprMatcher = memberExpr(isExpansionInMainFile()).bind("memberExpr");
-StatementMatcher declInOtherFile = declRefExpr(isExpansionInMainFile(), unless(hasDeclaration(isExpansionInMainFile()))).bind("declRef");
-TypeLocMatcher typesInMainFile = typeLoc(isExpansionInMainFile()).bind("typeLoc");
-DeclarationMatcher definitionsInMainFile = valueDecl(isExpansionInMainFile(), hasDeclContext(unless(isExpansionInMainFile()))).bind("decl");
-DeclarationMatcher declarationsInOtherFiles = namedDecl(unless(isExpansionInMainFile())).bind("declOther");
-DeclarationMatcher missingWarnUnusedResultMatcher = functionDecl(isExpansionInMainFile(),
-                                                         unless(isImplicit()),
-                                                         unless(hasName("main")),
-                                                         unless(returns(asString("void"))),
-                                                         unless(hasAttr(clang::attr::Kind::WarnUnusedResult))).bind("badFunc");
+static void write_summary(const PluginOptions &options, StringRef filename,
+                          const TUSummary &summary, double elapsed_ms)
+{
+    std::error_code ec;
+    std::unique_ptr<raw_fd_ostream> file;
+    raw_ostream *os = &llvm::outs();
+    if (options.summary_path != "-") {
+        file.reset(new raw_fd_ostream(options.summary_path, ec, sys::fs::OF_Append));
+        if (ec) {
+            llvm::errs() << "include cleaner: cannot open summary '" << options.summary_path
+                         << "': " << ec.message() << "\n";
+            return;
+        }
+        os = file.get();
+    }
+
+    /* buffer the line so concurrent compiles append whole records */
+    std::string line;
+    raw_string_ostream line_os(line);
+    json::OStream json(line_os);
+    json.object([&] {
+        json.attribute("file", filename);
+        json.attribute("includes", summary.includes);
+        json.attribute("declarations", summary.declarations);
+        json.attribute("usages", summary.usages);
+        json.attributeArray("unused", [&] {
+            for (const auto &name : summary.unused) json.value(name);
+        });
+        json.attributeArray("redundant_allowed", [&] {
+            for (const auto &name : summary.redundant_allowed) json.value(name);
+        });
+        json.attribute("time_ms", elapsed_ms);
+    });
+    line_os << "\n";
+    *os << line_os.str();
+    os->flush();
+}
+
+static void write_usage_record(const PluginOptions &options, StringRef filename,
+                               const IncludeState &state, double elapsed_ms)
+{
+    SmallString<256> abs_name(filename);
+    sys::fs::make_absolute(abs_name);
+    std::error_code ec = sys::fs::create_directories(options.db_dir);
+    SmallString<256> path(options.db_dir);
+    sys::path::append(path, llvm::utohexstr(xxHash64(abs_name)) + include_usage_db::RECORD_SUFFIX);
+    int fd;
+    SmallString<256> tmp_path;
+    if (!ec) ec = sys::fs::createUniqueFile(path + "-%%%%%%.tmp", fd, tmp_path);
+    if (ec) {
+        llvm::errs() << "include cleaner: cannot write usage record to '" << options.db_dir
+                     << "': " << ec.message() << "\n";
+        return;
+    }
+
+    {
+        raw_fd_ostream os(fd, /*shouldClose=*/true);
+        os << include_usage_db::TU_TAG << '\t' << abs_name << '\t'
+           << state.total_bytes << '\t' << format("%.3f", elapsed_ms) << '\n';
+        for (unsigned id = 0; id < state.usage_count.size(); ++id) {
+            if (!state.isTracked(id)) continue;
+            os << (state.direct[id] ? include_usage_db::INCLUDE_TAG : include_usage_db::USE_TAG)
+               << '\t' << state.files.name(id) << '\t'
+               << state.usage_count[id] << '\t' << state.bytes[id];
+            for (const std::string &symbol : state.symbols[id]) {
+                os << '\t' << symbol;
+            }
+            os << '\n';
+        }
+    }
+    /* rename so the aggregator never sees a partial record */
+    sys::fs::rename(tmp_path, path);
+}
 
 class PrintFunctionsConsumer : public ASTConsumer {
-    MatchFinder matcher;
-    DeclCheckerHandler *checkerHandler;
+    std::unique_ptr<IncludeState> includeState;
+    std::unique_ptr<DeclCheckerHandler> checkerHandler;
+    std::unique_ptr<DeclCache> declCache;
+    std::unique_ptr<ResultCache> resultCache;
+    HeaderSearch *headerSearch;
+    PluginOptions options;
+    std::string mainFilename;
+    std::chrono::steady_clock::time_point startTime;
     
 public:
-  PrintFunctionsConsumer(CompilerInstance &CI, llvm::StringRef filename) {      
+  PrintFunctionsConsumer(CompilerInstance &CI, llvm::StringRef filename, const PluginOptions &opts)
+      : options(opts), mainFilename(filename.str()), startTime(std::chrono::steady_clock::now()) {
       if (!isUserSourceWithFilename(filename.str())) {
           return;
       }
       
-      std::set<std::string> *includes_marked_as_allowed = new std::set<std::string>();
-      std::map<std::string, int> *include_usages_count = new std::map<std::string, int>();
-      std::map<std::string, SourceLocation> *include_locations = new std::map<std::string, SourceLocation>();
-      llvm::errs() << "Starting: " << filename.str() << " \n";
+      includeState.reset(new IncludeState(&CI.getSourceManager()));
+      includeState->record_usage = !options.db_dir.empty();
+      if (!options.decl_cache_dir.empty()) {
+          declCache.reset(new DeclCache(options.decl_cache_dir));
+      }
+      Preprocessor &pp = CI.getPreprocessor();
+      if (!options.result_cache_dir.empty()) {
+          resultCache.reset(new ResultCache(options.result_cache_dir, &CI.getSourceManager(),
+                                            pp.getPredefines(), includeState->record_usage));
+      }
+      IC_LOG(LOG_INFO, "Starting: " << filename.str() << " \n");
 
       std::unique_ptr<Find_Includes> find_includes_callback(
-          new Find_Includes(&CI.getSourceManager(), include_usages_count,
-                            includes_marked_as_allowed, include_locations));
+          new Find_Includes(&CI.getSourceManager(), includeState.get(), declCache.get(),
+                            resultCache.get()));
 
-      llvm::errs() << filename.str() << " \n";
-      Preprocessor &pp = CI.getPreprocessor();
+      headerSearch = &pp.getHeaderSearchInfo();
       pp.addPPCallbacks(std::move(find_includes_callback));
             
-      checkerHandler = new DeclCheckerHandler(include_usages_count, includes_marked_as_allowed, include_locations);
-      
-      matcher.addMatcher(objcInterfaceDecl().bind("ObjCInterfaceDecl"), checkerHandler); // 类名大小写
-      matcher.addMatcher(missingWarnUnusedResultMatcher, checkerHandler); // 未使用的 C 函数
-      
-      // 查询无效 include 文件
-      matcher.addMatcher(memberExprMatcher, checkerHandler);
-      matcher.addMatcher(declInOtherFile, checkerHandler);
-      matcher.addMatcher(typesInMainFile, checkerHandler);
-      matcher.addMatcher(definitionsInMainFile, checkerHandler);
-      matcher.addMatcher(declarationsInOtherFiles, checkerHandler);
+      checkerHandler.reset(new DeclCheckerHandler(includeState.get()));
+      checkerHandler->setDeclCache(declCache.get());
+      checkerHandler->setResultCache(resultCache.get());
+  }
+
+  /* Replays a cached result for this TU; false on a miss. */
+  bool replayCachedResult()
+  {
+      TUSummary counts;
+      std::vector<ResultCache::Diag> diags;
+      std::vector<ResultCache::Include> includes;
+      if (!resultCache->load(counts, diags, includes)) return false;
+      IC_LOG(LOG_INFO, "Result cache hit: " << mainFilename << " \n");
+      /* the include table, for the usage record */
+      for (const ResultCache::Include &include : includes) {
+          unsigned id = includeState->files.idForName(include.name);
+          includeState->grow(id);
+          includeState->tracked[id] = true;
+          includeState->usage_count[id] = include.count;
+          if (includeState->record_usage) {
+              includeState->bytes[id] = include.bytes;
+              includeState->symbols[id] = include.symbols;
+          }
+      }
+      checkerHandler->replay(*resultCache, counts, diags);
+      return true;
   }
 
   void HandleTranslationUnit(ASTContext& context) override {
-      matcher.matchAST(context);      
+      if (!checkerHandler) return;
+      checkerHandler->setContext(&context);
+      /* a TU with compile errors may not have a complete AST to cache */
+      if (resultCache && context.getDiagnostics().hasErrorOccurred()) {
+          resultCache->markUncacheable();
+      } else if (resultCache && replayCachedResult()) {
+          writeOutputs();
+          return;
+      }
+      if (declCache) {
+          DeclCheckerHandler *handler = checkerHandler.get();
+          declCache->resolve(*headerSearch, [handler](unsigned id, const DeclCache::Entry &entry) {
+              handler->handle_cached_declaration(id, entry);
+          });
+      }
+      IncludeUsageVisitor visitor(checkerHandler.get(), includeState.get(), declCache.get(),
+                                  context.getSourceManager());
+      visitor.TraverseDecl(context.getTranslationUnitDecl());
+      if (declCache) declCache->save();
+      checkerHandler->onEndOfTranslationUnit();
+      if (resultCache) resultCache->save(checkerHandler->summary(), *includeState);
+      writeOutputs();
+  }
+
+  void writeOutputs()
+  {
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - startTime;
+      if (!options.summary_path.empty()) {
+          write_summary(options, mainFilename, checkerHandler->summary(), elapsed.count());
+      }
+      if (!options.db_dir.empty()) {
+          write_usage_record(options, mainFilename, *includeState, elapsed.count());
+      }
   }
     
     bool isUserSourceWithFilename(const string filename)
@@ -593,16 +1366,54 @@ public:
 };
 
 class ToyASTAction : public PluginASTAction {
+  PluginOptions options;
+
 protected:
   std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
                                                  llvm::StringRef inFile) override {
-      return std::unique_ptr<PrintFunctionsConsumer>(new PrintFunctionsConsumer(CI, inFile));
+      return std::unique_ptr<PrintFunctionsConsumer>(new PrintFunctionsConsumer(CI, inFile, options));
   }
 
+  // -plugin-arg-print-fnso log=quiet|info|debug|trace
+  // -plugin-arg-print-fnso summary=<file>|-
+  // -plugin-arg-print-fnso db=<dir>
+  // -plugin-arg-print-fnso decl-cache=<dir>
+  // -plugin-arg-print-fnso result-cache=<dir>
   bool ParseArgs(const CompilerInstance &CI,
                  const std::vector<std::string> &args) override {
-      
-    return true;
+      for (const std::string &arg : args) {
+          StringRef key, value;
+          std::tie(key, value) = StringRef(arg).split('=');
+          if (key == "log") {
+              int level = llvm::StringSwitch<int>(value)
+                  .Case("quiet", LOG_QUIET)
+                  .Case("info", LOG_INFO)
+                  .Case("debug", LOG_DEBUG)
+                  .Case("trace", LOG_TRACE)
+                  .Default(-1);
+              if (level >= 0) {
+                  g_log_level = level;
+                  continue;
+              }
+          } else if (key == "summary" && !value.empty()) {
+              options.summary_path = value.str();
+              continue;
+          } else if (key == "db" && !value.empty()) {
+              options.db_dir = value.str();
+              continue;
+          } else if (key == "decl-cache" && !value.empty()) {
+              options.decl_cache_dir = value.str();
+              continue;
+          } else if (key == "result-cache" && !value.empty()) {
+              options.result_cache_dir = value.str();
+              continue;
+          }
+          DiagnosticsEngine &D = CI.getDiagnostics();
+          unsigned DiagID = D.getCustomDiagID(DiagnosticsEngine::Error, "print-fnso: invalid argument '%0'");
+          D.Report(DiagID) << arg;
+          return false;
+      }
+      return true;
   }
 
 };
@@ -0,0 +1,10 @@
+#include "box.h"
+
+struct Bar {
+    int y;
+};
+
+void set_bar(Box<Bar> *box)
+{
+    box->value.y = 2;
+}
@@ -0,0 +1,8 @@
+#ifndef BOX_H
+#define BOX_H
+
+template <typename T> struct Box {
+    T value;
+};
+
+#endif
@@ -0,0 +1,10 @@
+#include "box.h"
+
+struct Foo {
+    int x;
+};
+
+void set_foo(Box<Foo> *box)
+{
+    box->value.x = 1;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Two TUs instantiating the template of box.h differently, sharing one
+# decl cache: the second TU must still count box.h as used.
+#   PLUGIN=path/to/print-fnso.so [CLANG=clang++] ./run.sh
+set -e
+cd "$(dirname "$0")"
+CLANG=${CLANG:-clang++}
+cache=$(mktemp -d)
+trap 'rm -rf "$cache"' EXIT
+
+for tu in foo.cpp bar.cpp; do
+    out=$($CLANG -fsyntax-only -Xclang -load -Xclang "$PLUGIN" \
+        -Xclang -add-plugin -Xclang print-fnso \
+        -Xclang -plugin-arg-print-fnso -Xclang decl-cache="$cache" "$tu" 2>&1)
+    if echo "$out" | grep -q "unused #include of '.*box.h'"; then
+        echo "FAIL: $tu reports box.h as unused"
+        echo "$out"
+        exit 1
+    fi
+done
+echo PASS
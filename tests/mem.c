@@ -1,4 +1,4 @@
-#include <ios.h>
+#include <stdio.h>
 
 int main() {
     int c1 = 17;